@@ -11,18 +11,46 @@
 class CommandController extends Controller
 {
     /**
-     * Get pending commands for a device (polled by ESP8266)
+     * Longest a long poll may be held, in seconds. Kept under PHP's default
+     * 30 s max_execution_time.
      */
-    public function pending(Device $device)
+    private const MAX_WAIT = 25;
+
+    /**
+     * How often a held long poll checks for new commands, in microseconds.
+     */
+    private const WAIT_POLL_INTERVAL = 250000;
+
+    /**
+     * Get pending commands for a device (polled by ESP8266). With ?wait=N the
+     * request is held until a command is pending or N seconds have passed
+     * (long poll), so the device always has one poll outstanding.
+     */
+    public function pending(Request $request, Device $device)
     {
-        $commands = DeviceCommand::where('device_id', $device->id)
-            ->where('status', 'pending')
-            ->orderBy('created_at', 'asc')
-            ->get();
+        $validator = Validator::make($request->all(), [
+            'wait' => 'nullable|integer|between:0,' . self::MAX_WAIT,
+        ]);
 
-        $device->update(['last_seen_at' => now()]);
+        if ($validator->fails()) {
+            return response()->json(['errors' => $validator->errors()], 422);
+        }
+
+        // The heartbeat keeps last_seen_at fresh; a poll only needs to write
+        // it when it's gone stale.
+        if ($device->last_seen_at === null || $device->last_seen_at->isBefore(now()->subMinute())) {
+            $device->update(['last_seen_at' => now()]);
+        }
+
+        $pending = fn () => DeviceCommand::where('device_id', $device->id)
+            ->where('status', 'pending');
+
+        $deadline = microtime(true) + (int) $request->query('wait', 0);
+        while (microtime(true) < $deadline && !$pending()->exists()) {
+            usleep(self::WAIT_POLL_INTERVAL);
+        }
 
-        return response()->json(['commands' => $commands]);
+        return response()->json(['commands' => $this->pendingCommands($device)]);
     }
 
     /**
@@ -41,8 +69,17 @@ public function store(Request $request, Device $device)
         }
 
         $validator = Validator::make($request->all(), [
-            'type' => 'required|in:set_relay_mode,set_relay_type,set_thresholds,set_frequency,set_unit,restart',
+            'type' => 'required|in:set_relay_mode,set_relay_type,set_thresholds,set_pid,set_schedule,set_frequency,set_unit,restart',
             'params' => 'required|array',
+            // set_schedule replaces the device's whole weekly schedule; the
+            // limits mirror SCHEDULE_MAX_ENTRIES in the firmware.
+            'params.relays' => 'required_if:type,set_schedule|array|max:8',
+            'params.relays.*.relay_number' => 'required|integer|between:1,8|distinct',
+            'params.relays.*.entries' => 'present|array|max:16',
+            'params.relays.*.entries.*.days' => 'required|integer|between:1,127',
+            'params.relays.*.entries.*.at' => 'required|integer|between:0,1439',
+            'params.relays.*.entries.*.temp_on' => 'required|numeric',
+            'params.relays.*.entries.*.temp_off' => 'required|numeric',
         ]);
 
         if ($validator->fails()) {
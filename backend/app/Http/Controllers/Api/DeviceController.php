@@ -69,7 +69,10 @@ public function heartbeat(Request $request, Device $device)
             'ip_address' => $request->ip_address ?? $device->ip_address,
         ]);
 
-        return response()->json(['message' => 'Heartbeat updated']);
+        return response()->json([
+            'message' => 'Heartbeat updated',
+            ...$this->deviceSync($request, $device),
+        ]);
     }
 
     /**
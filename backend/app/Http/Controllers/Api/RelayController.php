@@ -16,28 +16,13 @@ class RelayController extends Controller
      */
     public function updateState(Request $request, Device $device)
     {
-        $validator = Validator::make($request->all(), [
-            'relay_number' => 'required|integer|between:1,4',
-            'state' => 'required|boolean',
-            'mode' => 'required|in:AUTO,MANUAL_ON,MANUAL_OFF',
-            'temp_on' => 'required|numeric',
-            'temp_off' => 'required|numeric',
-            'name' => 'nullable|string|max:255',
-        ]);
+        $validator = Validator::make($request->all(), self::stateRules());
 
         if ($validator->fails()) {
             return response()->json(['errors' => $validator->errors()], 422);
         }
 
-        $relay = Relay::firstOrCreate(
-            [
-                'device_id' => $device->id,
-                'relay_number' => $request->relay_number,
-            ],
-            [
-                'name' => $request->name ?? "Relay {$request->relay_number}",
-            ]
-        );
+        $relay = $this->relayFor($device, $request->relay_number, $request->name);
 
         // Idempotent: if the latest stored state matches the incoming payload
         // exactly, skip the INSERT. Devices re-send on every boot and on every
@@ -47,26 +32,10 @@ public function updateState(Request $request, Device $device)
             ->latest('changed_at')
             ->first();
 
-        $incomingTempOn  = round((float) $request->temp_on, 2);
-        $incomingTempOff = round((float) $request->temp_off, 2);
-
-        $isDuplicate = $latest
-            && (bool) $latest->state === (bool) $request->state
-            && $latest->mode === $request->mode
-            && round((float) $latest->temp_on, 2) === $incomingTempOn
-            && round((float) $latest->temp_off, 2) === $incomingTempOff;
-
-        $state = $latest;
-        if (!$isDuplicate) {
-            $state = RelayState::create([
-                'relay_id' => $relay->id,
-                'state'    => $request->state,
-                'mode'     => $request->mode,
-                'temp_on'  => $request->temp_on,
-                'temp_off' => $request->temp_off,
-                'changed_at' => now(),
-            ]);
-        }
+        $row = $this->stateRow($relay, $request->all(), now());
+        $isDuplicate = $latest && self::sameState($latest->getAttributes(), $row);
+
+        $state = $isDuplicate ? $latest : RelayState::create($row);
 
         $device->update(['last_seen_at' => now()]);
 
@@ -74,9 +43,145 @@ public function updateState(Request $request, Device $device)
             'message'  => $isDuplicate ? 'No change, ignored' : 'Relay state updated',
             'relay_id' => $relay->id,
             'state_id' => $state?->id,
+            ...$this->deviceSync($request, $device),
         ], $isDuplicate ? 200 : 201);
     }
 
+    /**
+     * Store a batch of relay states buffered on the device, oldest first.
+     * changed_at is the device's epoch seconds at the time of the change.
+     * Same dedupe as updateState, applied along the batch, then one INSERT.
+     */
+    public function updateStateBatch(Request $request, Device $device)
+    {
+        $validator = Validator::make($request->all(), [
+            'states' => 'required|array|min:1|max:100',
+            ...self::stateRules('states.*.'),
+            'states.*.changed_at' => 'nullable|integer|min:0',
+        ]);
+
+        if ($validator->fails()) {
+            return response()->json(['errors' => $validator->errors()], 422);
+        }
+
+        $now = now();
+        $relays = [];
+        $previous = [];
+        $rows = [];
+        foreach ($request->input('states') as $in) {
+            $number = (int) $in['relay_number'];
+            if (!isset($relays[$number])) {
+                $relays[$number] = $this->relayFor($device, $number, $in['name'] ?? null);
+                $previous[$number] = RelayState::where('relay_id', $relays[$number]->id)
+                    ->latest('changed_at')
+                    ->first()
+                    ?->getAttributes();
+            }
+
+            $row = $this->stateRow($relays[$number], $in, $this->deviceTime($in['changed_at'] ?? null, $now));
+            if ($previous[$number] && self::sameState($previous[$number], $row)) {
+                continue;
+            }
+            $rows[] = $row;
+            $previous[$number] = $row;
+        }
+
+        if ($rows) {
+            RelayState::insert($rows);
+        }
+
+        $device->update(['last_seen_at' => $now]);
+
+        return response()->json([
+            'message' => 'Relay states stored',
+            'count'   => count($rows),
+            ...$this->deviceSync($request, $device),
+        ], 201);
+    }
+
+    /**
+     * Validation for one relay state; $prefix scopes it to a batch entry.
+     */
+    private static function stateRules(string $prefix = ''): array
+    {
+        return [
+            $prefix . 'relay_number' => 'required|integer|between:1,8', // 4- and 8-channel boards
+            $prefix . 'state' => 'required|boolean',
+            $prefix . 'deferred_state' => 'nullable|boolean',
+            $prefix . 'deferred_in' => 'nullable|integer|min:0',
+            $prefix . 'mode' => 'required|in:AUTO,MANUAL_ON,MANUAL_OFF,PID',
+            $prefix . 'temp_on' => 'required|numeric',
+            $prefix . 'temp_off' => 'required|numeric',
+            // decimal(8,4) columns: anything wider fails the insert
+            $prefix . 'pid_kp' => "required_if:{$prefix}mode,PID|numeric|between:-9999.9999,9999.9999",
+            $prefix . 'pid_ki' => "required_if:{$prefix}mode,PID|numeric|between:-9999.9999,9999.9999",
+            $prefix . 'pid_kd' => "required_if:{$prefix}mode,PID|numeric|between:-9999.9999,9999.9999",
+            $prefix . 'pid_window' => "required_if:{$prefix}mode,PID|integer|between:30,3600",
+            $prefix . 'duty' => "required_if:{$prefix}mode,PID|numeric|between:0,1",
+            $prefix . 'name' => 'nullable|string|max:255',
+        ];
+    }
+
+    private function relayFor(Device $device, int $relayNumber, ?string $name): Relay
+    {
+        return Relay::firstOrCreate(
+            [
+                'device_id' => $device->id,
+                'relay_number' => $relayNumber,
+            ],
+            [
+                'name' => $name ?? "Relay {$relayNumber}",
+            ]
+        );
+    }
+
+    /**
+     * relay_states row for one validated payload. PID columns are only set
+     * in PID mode.
+     */
+    private function stateRow(Relay $relay, array $in, $changedAt): array
+    {
+        $isPid = $in['mode'] === 'PID';
+
+        return [
+            'relay_id'       => $relay->id,
+            'state'          => filter_var($in['state'], FILTER_VALIDATE_BOOLEAN),
+            'deferred_state' => isset($in['deferred_state']) ? filter_var($in['deferred_state'], FILTER_VALIDATE_BOOLEAN) : null,
+            'mode'           => $in['mode'],
+            'temp_on'        => $in['temp_on'],
+            'temp_off'       => $in['temp_off'],
+            'pid_kp'         => $isPid ? $in['pid_kp'] : null,
+            'pid_ki'         => $isPid ? $in['pid_ki'] : null,
+            'pid_kd'         => $isPid ? $in['pid_kd'] : null,
+            'pid_window'     => $isPid ? (int) $in['pid_window'] : null,
+            'duty'           => $isPid ? $in['duty'] : null,
+            'changed_at'     => $changedAt,
+        ];
+    }
+
+    /**
+     * Whether two relay_states rows (raw attributes or stateRow output)
+     * describe the same state, at the precision the columns store. The PID
+     * duty is telemetry, not configuration, so it doesn't make a state
+     * distinct on its own.
+     */
+    private static function sameState(array $a, array $b): bool
+    {
+        $bool = fn ($v) => $v === null ? null : (bool) $v;
+        $dec = fn ($v, $places) => $v === null ? null : round((float) $v, $places);
+        $int = fn ($v) => $v === null ? null : (int) $v;
+
+        return $bool($a['state']) === $bool($b['state'])
+            && $bool($a['deferred_state']) === $bool($b['deferred_state'])
+            && $a['mode'] === $b['mode']
+            && $dec($a['temp_on'], 2) === $dec($b['temp_on'], 2)
+            && $dec($a['temp_off'], 2) === $dec($b['temp_off'], 2)
+            && $dec($a['pid_kp'], 4) === $dec($b['pid_kp'], 4)
+            && $dec($a['pid_ki'], 4) === $dec($b['pid_ki'], 4)
+            && $dec($a['pid_kd'], 4) === $dec($b['pid_kd'], 4)
+            && $int($a['pid_window']) === $int($b['pid_window']);
+    }
+
     /**
      * Get all relays for a device
      */
@@ -36,6 +36,43 @@ public function store(Request $request, Device $device)
         return response()->json([
             'message' => 'Temperature reading stored',
             'reading_id' => $reading->id,
+            ...$this->deviceSync($request, $device),
+        ], 201);
+    }
+
+    /**
+     * Store a batch of readings buffered on the device, in one INSERT.
+     * recorded_at is the device's epoch seconds at the time of the reading.
+     */
+    public function storeBatch(Request $request, Device $device)
+    {
+        $validator = Validator::make($request->all(), [
+            'readings' => 'required|array|min:1|max:100',
+            'readings.*.temperature' => 'required|numeric|between:-50,150',
+            'readings.*.sensor_id' => 'nullable|integer|between:0,255',
+            'readings.*.recorded_at' => 'nullable|integer|min:0',
+        ]);
+
+        if ($validator->fails()) {
+            return response()->json(['errors' => $validator->errors()], 422);
+        }
+
+        $now = now();
+        $rows = array_map(fn (array $r) => [
+            'device_id' => $device->id,
+            'temperature' => $r['temperature'],
+            'sensor_id' => $r['sensor_id'] ?? 0,
+            'recorded_at' => $this->deviceTime($r['recorded_at'] ?? null, $now),
+        ], $request->input('readings'));
+
+        TemperatureReading::insert($rows);
+
+        $device->update(['last_seen_at' => $now]);
+
+        return response()->json([
+            'message' => 'Temperature readings stored',
+            'count' => count($rows),
+            ...$this->deviceSync($request, $device),
         ], 201);
     }
 
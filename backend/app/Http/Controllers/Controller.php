@@ -2,7 +2,77 @@
 
 namespace App\Http\Controllers;
 
+use App\Models\Device;
+use App\Models\DeviceCommand;
+use Illuminate\Http\Request;
+use Illuminate\Support\Carbon;
+use Illuminate\Support\Collection;
+
 abstract class Controller
 {
-    //
+    /**
+     * Most commands handed to a device at once; matches the firmware's
+     * pending command queue.
+     */
+    private const DEVICE_COMMAND_PAGE = 10;
+
+    /**
+     * Timestamp for a row the device buffered: its epoch seconds, or now if
+     * the device had no clock yet (0 / missing). Never later than now, so a
+     * skewed device clock can't write into the future.
+     */
+    protected function deviceTime(?int $epoch, Carbon $now): Carbon
+    {
+        if (!$epoch) {
+            return $now;
+        }
+
+        return Carbon::createFromTimestamp($epoch)->min($now);
+    }
+
+    /**
+     * Extra fields for responses to the device's own sync calls (telemetry
+     * and heartbeat): its pending commands and the desired config version,
+     * plus the config itself when the device reports an older version in
+     * X-Config-Version.
+     */
+    protected function deviceSync(Request $request, Device $device): array
+    {
+        $settings = $device->settings;
+        $version = $settings?->config_version ?? 0;
+
+        $sync = [
+            'commands' => $this->pendingCommands($device),
+            'config_version' => $version,
+        ];
+
+        if ($settings && (int) $request->header('X-Config-Version', 0) < $version) {
+            $sync['config'] = [
+                'update_frequency' => $settings->update_frequency,
+                'use_fahrenheit' => $settings->use_fahrenheit,
+            ];
+        }
+
+        return $sync;
+    }
+
+    /**
+     * The device's pending commands, oldest first, with only the fields the
+     * firmware reads. A page stops before a second set_schedule: one full
+     * schedule nearly fills the device's receive buffer and it applies one
+     * at a time anyway. The rest follow once these are acknowledged.
+     */
+    protected function pendingCommands(Device $device): Collection
+    {
+        $commands = DeviceCommand::forDevice($device->id)
+            ->pending()
+            ->orderBy('created_at', 'asc')
+            ->orderBy('id', 'asc')
+            ->limit(self::DEVICE_COMMAND_PAGE)
+            ->get(['id', 'type', 'params']);
+
+        $second = $commands->where('type', 'set_schedule')->keys()->get(1);
+
+        return $second === null ? $commands : $commands->take($second);
+    }
 }
@@ -0,0 +1,50 @@
+<?php
+
+namespace App\Http\Middleware;
+
+use App\Services\MessagePack;
+use Closure;
+use Illuminate\Http\JsonResponse;
+use Illuminate\Http\Request;
+use InvalidArgumentException;
+use Symfony\Component\HttpFoundation\Response;
+
+class NegotiateMessagePack
+{
+    /**
+     * Accept MessagePack request bodies and answer in MessagePack when the
+     * client prefers it over JSON. Controllers keep working with plain arrays
+     * and JSON responses either way.
+     *
+     * @param  \Closure(\Illuminate\Http\Request): (\Symfony\Component\HttpFoundation\Response)  $next
+     */
+    public function handle(Request $request, Closure $next): Response
+    {
+        if (str_starts_with((string) $request->header('Content-Type'), 'application/msgpack')) {
+            try {
+                $data = MessagePack::decode($request->getContent());
+            } catch (InvalidArgumentException $e) {
+                return response()->json([
+                    'error' => 'Bad Request',
+                    'message' => 'Invalid MessagePack body',
+                ], 400);
+            }
+
+            $request->request->replace(is_array($data) ? $data : []);
+        }
+
+        $response = $next($request);
+
+        if (!$response instanceof JsonResponse
+            || $request->prefers(['application/json', 'application/msgpack']) !== 'application/msgpack') {
+            return $response;
+        }
+
+        $packed = response(MessagePack::encode($response->getData(true)), $response->getStatusCode());
+        $packed->headers->add($response->headers->all());
+        $packed->headers->set('Content-Type', 'application/msgpack');
+        $packed->setVary('Accept', false);
+
+        return $packed;
+    }
+}
@@ -19,8 +19,20 @@ class DeviceSetting extends Model
         'update_frequency' => 'integer',
         'use_fahrenheit' => 'boolean',
         'settings_json' => 'array',
+        'config_version' => 'integer',
     ];
 
+    protected static function booted(): void
+    {
+        // The device picks up a new version from its next sync response
+        // (see Controller::deviceSync) and applies these settings.
+        static::saving(function (DeviceSetting $settings) {
+            if ($settings->exists && $settings->isDirty(['update_frequency', 'use_fahrenheit'])) {
+                $settings->config_version++;
+            }
+        });
+    }
+
     public function device(): BelongsTo
     {
         return $this->belongsTo(Device::class);
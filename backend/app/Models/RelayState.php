@@ -12,16 +12,28 @@ class RelayState extends Model
     protected $fillable = [
         'relay_id',
         'state',
+        'deferred_state',
         'mode',
         'temp_on',
         'temp_off',
+        'pid_kp',
+        'pid_ki',
+        'pid_kd',
+        'pid_window',
+        'duty',
         'changed_at',
     ];
 
     protected $casts = [
         'state' => 'boolean',
+        'deferred_state' => 'boolean',
         'temp_on' => 'decimal:2',
         'temp_off' => 'decimal:2',
+        'pid_kp' => 'decimal:4',
+        'pid_ki' => 'decimal:4',
+        'pid_kd' => 'decimal:4',
+        'pid_window' => 'integer',
+        'duty' => 'decimal:4',
         'changed_at' => 'datetime',
     ];
 
@@ -0,0 +1,193 @@
+<?php
+
+namespace App\Services;
+
+use InvalidArgumentException;
+
+/**
+ * Minimal MessagePack codec for the device API: nil, bool, int, float, str,
+ * bin, array and map, which is everything ArduinoJson produces and consumes.
+ * Maps decode to associative arrays, like json_decode(..., true).
+ */
+class MessagePack
+{
+    public static function encode(mixed $value): string
+    {
+        return match (true) {
+            $value === null => "\xc0",
+            $value === false => "\xc2",
+            $value === true => "\xc3",
+            is_int($value) => self::encodeInt($value),
+            is_float($value) => "\xcb" . pack('E', $value),
+            is_string($value) => self::encodeString($value),
+            is_array($value) => self::encodeArray($value),
+            $value instanceof \JsonSerializable => self::encode($value->jsonSerialize()),
+            default => throw new InvalidArgumentException('Cannot encode ' . get_debug_type($value)),
+        };
+    }
+
+    public static function decode(string $data): mixed
+    {
+        $offset = 0;
+        $value = self::decodeValue($data, $offset);
+
+        if ($offset !== strlen($data)) {
+            throw new InvalidArgumentException('Trailing bytes after MessagePack value');
+        }
+
+        return $value;
+    }
+
+    private static function encodeInt(int $value): string
+    {
+        if ($value >= 0) {
+            return match (true) {
+                $value <= 0x7f => chr($value),
+                $value <= 0xff => "\xcc" . chr($value),
+                $value <= 0xffff => "\xcd" . pack('n', $value),
+                $value <= 0xffffffff => "\xce" . pack('N', $value),
+                default => "\xcf" . pack('J', $value),
+            };
+        }
+
+        return match (true) {
+            $value >= -32 => chr($value & 0xff),
+            $value >= -0x80 => "\xd0" . chr($value & 0xff),
+            $value >= -0x8000 => "\xd1" . pack('n', $value & 0xffff),
+            $value >= -0x80000000 => "\xd2" . pack('N', $value & 0xffffffff),
+            default => "\xd3" . pack('J', $value),
+        };
+    }
+
+    private static function encodeString(string $value): string
+    {
+        $length = strlen($value);
+
+        return match (true) {
+            $length <= 31 => chr(0xa0 | $length),
+            $length <= 0xff => "\xd9" . chr($length),
+            $length <= 0xffff => "\xda" . pack('n', $length),
+            default => "\xdb" . pack('N', $length),
+        } . $value;
+    }
+
+    private static function encodeArray(array $value): string
+    {
+        $count = count($value);
+        $out = '';
+
+        if (array_is_list($value)) {
+            $out = match (true) {
+                $count <= 15 => chr(0x90 | $count),
+                $count <= 0xffff => "\xdc" . pack('n', $count),
+                default => "\xdd" . pack('N', $count),
+            };
+            foreach ($value as $item) {
+                $out .= self::encode($item);
+            }
+
+            return $out;
+        }
+
+        $out = match (true) {
+            $count <= 15 => chr(0x80 | $count),
+            $count <= 0xffff => "\xde" . pack('n', $count),
+            default => "\xdf" . pack('N', $count),
+        };
+        foreach ($value as $key => $item) {
+            $out .= self::encode((string) $key) . self::encode($item);
+        }
+
+        return $out;
+    }
+
+    private static function decodeValue(string $data, int &$offset): mixed
+    {
+        $type = ord(self::take($data, $offset, 1));
+
+        if ($type <= 0x7f) {
+            return $type;
+        }
+        if ($type >= 0xe0) {
+            return $type - 0x100;
+        }
+        if (($type & 0xf0) === 0x80) {
+            return self::decodeMap($data, $offset, $type & 0x0f);
+        }
+        if (($type & 0xf0) === 0x90) {
+            return self::decodeList($data, $offset, $type & 0x0f);
+        }
+        if (($type & 0xe0) === 0xa0) {
+            return self::take($data, $offset, $type & 0x1f);
+        }
+
+        return match ($type) {
+            0xc0 => null,
+            0xc2 => false,
+            0xc3 => true,
+            0xc4, 0xd9 => self::take($data, $offset, self::unpack('C', $data, $offset, 1)),
+            0xc5, 0xda => self::take($data, $offset, self::unpack('n', $data, $offset, 2)),
+            0xc6, 0xdb => self::take($data, $offset, self::unpack('N', $data, $offset, 4)),
+            0xca => self::unpack('G', $data, $offset, 4),
+            0xcb => self::unpack('E', $data, $offset, 8),
+            0xcc => self::unpack('C', $data, $offset, 1),
+            0xcd => self::unpack('n', $data, $offset, 2),
+            0xce => self::unpack('N', $data, $offset, 4),
+            0xcf => self::unpack('J', $data, $offset, 8),
+            0xd0 => self::unpack('c', $data, $offset, 1),
+            0xd1 => self::signed(self::unpack('n', $data, $offset, 2), 16),
+            0xd2 => self::signed(self::unpack('N', $data, $offset, 4), 32),
+            0xd3 => self::unpack('J', $data, $offset, 8),  // PHP ints are signed 64-bit
+            0xdc => self::decodeList($data, $offset, self::unpack('n', $data, $offset, 2)),
+            0xdd => self::decodeList($data, $offset, self::unpack('N', $data, $offset, 4)),
+            0xde => self::decodeMap($data, $offset, self::unpack('n', $data, $offset, 2)),
+            0xdf => self::decodeMap($data, $offset, self::unpack('N', $data, $offset, 4)),
+            default => throw new InvalidArgumentException(sprintf('Unsupported MessagePack type 0x%02x', $type)),
+        };
+    }
+
+    private static function decodeList(string $data, int &$offset, int $count): array
+    {
+        $list = [];
+        for ($i = 0; $i < $count; $i++) {
+            $list[] = self::decodeValue($data, $offset);
+        }
+
+        return $list;
+    }
+
+    private static function decodeMap(string $data, int &$offset, int $count): array
+    {
+        $map = [];
+        for ($i = 0; $i < $count; $i++) {
+            $key = self::decodeValue($data, $offset);
+            if (!is_string($key) && !is_int($key)) {
+                throw new InvalidArgumentException('MessagePack map key must be a string or integer');
+            }
+            $map[$key] = self::decodeValue($data, $offset);
+        }
+
+        return $map;
+    }
+
+    private static function take(string $data, int &$offset, int $length): string
+    {
+        if ($offset + $length > strlen($data)) {
+            throw new InvalidArgumentException('Truncated MessagePack data');
+        }
+        $bytes = substr($data, $offset, $length);
+        $offset += $length;
+
+        return $bytes;
+    }
+
+    private static function unpack(string $format, string $data, int &$offset, int $length): int|float
+    {
+        return unpack($format, self::take($data, $offset, $length))[1];
+    }
+
+    private static function signed(int $value, int $bits): int
+    {
+        return $value >= (1 << ($bits - 1)) ? $value - (1 << $bits) : $value;
+    }
+}
@@ -17,6 +17,7 @@
             'api.key' => \App\Http\Middleware\ValidateApiKey::class,
             'admin' => \App\Http\Middleware\EnsureUserIsAdmin::class,
             'device.scope' => \App\Http\Middleware\EnsureDeviceTokenMatchesRoute::class,
+            'msgpack' => \App\Http\Middleware\NegotiateMessagePack::class,
         ]);
     })
     ->withSchedule(function (Schedule $schedule): void {
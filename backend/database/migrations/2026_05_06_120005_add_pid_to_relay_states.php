@@ -0,0 +1,34 @@
+<?php
+
+use Illuminate\Database\Migrations\Migration;
+use Illuminate\Database\Schema\Blueprint;
+use Illuminate\Support\Facades\DB;
+use Illuminate\Support\Facades\Schema;
+
+return new class extends Migration
+{
+    public function up(): void
+    {
+        DB::statement("ALTER TABLE relay_states MODIFY COLUMN mode ENUM('AUTO', 'MANUAL_ON', 'MANUAL_OFF', 'PID')");
+
+        // Only filled for PID rows: the gains in effect and the duty cycle
+        // (0..1) the device latched for that window.
+        Schema::table('relay_states', function (Blueprint $table) {
+            $table->decimal('pid_kp', 8, 4)->nullable()->after('temp_off');
+            $table->decimal('pid_ki', 8, 4)->nullable()->after('pid_kp');
+            $table->decimal('pid_kd', 8, 4)->nullable()->after('pid_ki');
+            $table->unsignedSmallInteger('pid_window')->nullable()->after('pid_kd');
+            $table->decimal('duty', 5, 4)->nullable()->after('pid_window');
+        });
+    }
+
+    public function down(): void
+    {
+        Schema::table('relay_states', function (Blueprint $table) {
+            $table->dropColumn(['pid_kp', 'pid_ki', 'pid_kd', 'pid_window', 'duty']);
+        });
+
+        // Will fail if any rows still have mode = PID
+        DB::statement("ALTER TABLE relay_states MODIFY COLUMN mode ENUM('AUTO', 'MANUAL_ON', 'MANUAL_OFF')");
+    }
+};
@@ -0,0 +1,18 @@
+<?php
+
+use Illuminate\Database\Migrations\Migration;
+use Illuminate\Support\Facades\DB;
+
+return new class extends Migration
+{
+    public function up(): void
+    {
+        DB::statement("ALTER TABLE device_commands MODIFY COLUMN type ENUM('set_relay_mode', 'set_relay_type', 'set_thresholds', 'set_pid', 'set_frequency', 'set_unit', 'restart')");
+    }
+
+    public function down(): void
+    {
+        // Will fail if any rows have type = set_pid
+        DB::statement("ALTER TABLE device_commands MODIFY COLUMN type ENUM('set_relay_mode', 'set_relay_type', 'set_thresholds', 'set_frequency', 'set_unit', 'restart')");
+    }
+};
@@ -0,0 +1,24 @@
+<?php
+
+use Illuminate\Database\Migrations\Migration;
+use Illuminate\Database\Schema\Blueprint;
+use Illuminate\Support\Facades\Schema;
+
+return new class extends Migration
+{
+    public function up(): void
+    {
+        // State a short-cycle-protected transition is waiting for; null when
+        // nothing is deferred.
+        Schema::table('relay_states', function (Blueprint $table) {
+            $table->boolean('deferred_state')->nullable()->after('state');
+        });
+    }
+
+    public function down(): void
+    {
+        Schema::table('relay_states', function (Blueprint $table) {
+            $table->dropColumn('deferred_state');
+        });
+    }
+};
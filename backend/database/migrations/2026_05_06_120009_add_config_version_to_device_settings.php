@@ -0,0 +1,25 @@
+<?php
+
+use Illuminate\Database\Migrations\Migration;
+use Illuminate\Database\Schema\Blueprint;
+use Illuminate\Support\Facades\Schema;
+
+return new class extends Migration
+{
+    public function up(): void
+    {
+        // Bumped whenever settings the device applies itself change; the
+        // device reports the version it has and is sent the settings when
+        // it's behind.
+        Schema::table('device_settings', function (Blueprint $table) {
+            $table->unsignedInteger('config_version')->default(0)->after('timezone');
+        });
+    }
+
+    public function down(): void
+    {
+        Schema::table('device_settings', function (Blueprint $table) {
+            $table->dropColumn('config_version');
+        });
+    }
+};
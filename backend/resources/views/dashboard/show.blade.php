@@ -158,12 +158,22 @@
                                 <button class="mode-btn {{ $currentState->mode == 'MANUAL_OFF' ? 'active' : '' }}"
                                         onclick="setRelayMode({{ $relay->relay_number }}, 'MANUAL_OFF')"
                                         data-mode="MANUAL_OFF">OFF</button>
+                                <button class="mode-btn {{ $currentState->mode == 'PID' ? 'active' : '' }}"
+                                        onclick="setRelayMode({{ $relay->relay_number }}, 'PID')"
+                                        data-mode="PID">PID</button>
                             </div>
                         @else
                             <div style="margin-top: 5px;">
                                 <span class="mode-badge">{{ $currentState->mode }}</span>
                             </div>
                         @endif
+                        @if($currentState->mode == 'PID' && $currentState->duty !== null)
+                            <div style="margin-top: 5px; color: #666; font-size: 12px;">
+                                Duty {{ round($currentState->duty * 100) }}% ·
+                                Kp {{ $currentState->pid_kp }} · Ki {{ $currentState->pid_ki }} · Kd {{ $currentState->pid_kd }} ·
+                                {{ $currentState->pid_window }}s window
+                            </div>
+                        @endif
                     </div>
 
                     <div style="margin: 10px 0;">
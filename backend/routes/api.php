@@ -14,22 +14,25 @@
 
 // Device Registration (requires API key, rate limited to 10 per minute)
 Route::post('/devices/register', [DeviceController::class, 'register'])
-    ->middleware(['api.key', 'throttle:10,1']);
+    ->middleware(['msgpack', 'api.key', 'throttle:10,1']);
 
 // Device-token API: every endpoint here is called by the firmware itself, so
 // we additionally require the token's owner device to match the {device} bind.
-Route::middleware(['auth:sanctum', 'throttle:120,1', 'device.scope'])->group(function () {
+// Bodies may be MessagePack instead of JSON (see NegotiateMessagePack).
+Route::middleware(['msgpack', 'auth:sanctum', 'throttle:120,1', 'device.scope'])->group(function () {
     Route::post('/devices/{device}/heartbeat', [DeviceController::class, 'heartbeat']);
     Route::get('/devices/{device}', [DeviceController::class, 'show']);
     Route::get('/devices/{device}/dashboard-data', [DeviceController::class, 'dashboardData']);
 
     // Temperature Readings
     Route::post('/devices/{device}/temperature', [TemperatureController::class, 'store']);
+    Route::post('/devices/{device}/temperature/batch', [TemperatureController::class, 'storeBatch']);
     Route::get('/devices/{device}/temperature', [TemperatureController::class, 'index']);
     Route::get('/devices/{device}/temperature/stats', [TemperatureController::class, 'stats']);
 
     // Relay Management
     Route::post('/devices/{device}/relay-state', [RelayController::class, 'updateState']);
+    Route::post('/devices/{device}/relay-state/batch', [RelayController::class, 'updateStateBatch']);
     Route::get('/devices/{device}/relays', [RelayController::class, 'index']);
     Route::get('/devices/{device}/relays/{relay}/history', [RelayController::class, 'history']);
 
@@ -3,26 +3,58 @@
 #include "SystemLogger.h"
 #include "Credentials.h"
 #include <LittleFS.h>
+#include <time.h>
 
 extern SystemLogger logger;
 
 ApiClient::ApiClient(const String& apiUrl)
   : apiUrl(apiUrl), deviceId(-1), authToken(""),
-    pendingCommandCount(0), nextCommandIdx(0), tempDirty(false) {
-  useHttps = apiUrl.startsWith("https://");
-  for (int i = 0; i < 4; i++) {
-    relayDirty[i] = false;
-    lastSent[i].valid = false;
-  }
+    useHttps(apiUrl.startsWith("https://")),
+    io(ioBuffer, sizeof(ioBuffer)),
+    http(useHttps ? (WiFiClient&)wifiClientSecure : wifiClient, io),
+    commandHttp(useHttps ? (WiFiClient&)commandClientSecure : commandClient, io),
+    commandBuffersProbed(false), commandHeapLow(false), bothOpenLogged(false),
+    pendingCommandCount(0), nextCommandIdx(0), lastCommandId(0), scheduleQueued(false), configVersion(0), configPending(false),
+    statusHead(0), statusCount(0),
+    readings(OUTBOX_READINGS_FILE, sizeof(TempRecord), OUTBOX_READINGS_CAPACITY, OUTBOX_STAGE_INTERVAL),
+    relayStates(OUTBOX_RELAY_FILE, sizeof(RelayRecord), OUTBOX_RELAY_CAPACITY),
+    readingsCarried(0), relayStatesCarried(0), readingsSince(0), lastRelayQueued(0),
+    lastUpload(0), outboxFullLogged(false), docArena(docBuffer, sizeof(docBuffer)),
+    useMsgPack(false), responseMsgPack(false) {
 }
 
 void ApiClient::begin() {
   if (useHttps) {
     wifiClientSecure.setInsecure();
     wifiClientSecure.setBufferSizes(TLS_RX_BUFFER, TLS_TX_BUFFER);
-  }
+    wifiClientSecure.setSession(&tlsSession);
+    commandClientSecure.setInsecure();
+    commandClientSecure.setBufferSizes(TLS_RX_BUFFER, TLS_TX_BUFFER);
+    commandClientSecure.setSession(&commandTlsSession);
+  }
+  if (!http.begin(apiUrl) || !commandHttp.begin(apiUrl)) {
+    logger.addLog("ERROR: Bad API URL " + apiUrl);
+  }
+  // The backend holds the poll for up to API_COMMAND_WAIT before answering
+  commandHttp.setResponseTimeout(API_COMMAND_WAIT * 1000UL + HTTP_HEADER_TIMEOUT);
+
+  // Everything else in a response (timestamps, status, device fields) is
+  // skipped while parsing instead of being stored
+  JsonObject command = syncFilter["commands"].add<JsonObject>();
+  command["id"] = true;
+  command["type"] = true;
+  command["params"] = true;
+  syncFilter["config_version"] = true;
+  syncFilter["config"] = true;
 
   loadToken();
+
+  // Whatever an outage or reboot left behind goes up as soon as we're online
+  readings.begin();
+  relayStates.begin();
+  readingsCarried = readings.size();
+  relayStatesCarried = relayStates.size();
+  readingsSince = millis() - TELEMETRY_FLUSH_INTERVAL;
 }
 
 void ApiClient::loadToken() {
@@ -56,53 +88,36 @@ void ApiClient::saveToken(const String& token) {
 }
 
 bool ApiClient::registerDevice(const String& hostname, const String& macAddress, const String& ipAddress, const String& firmwareVersion) {
-  JsonDocument doc;
+  JsonDocument doc(&docArena);
   doc["hostname"] = hostname;
   doc["mac_address"] = macAddress;
   doc["ip_address"] = ipAddress;
   doc["firmware_version"] = firmwareVersion;
 
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
-
   if (WiFi.status() != WL_CONNECTED) {
     logger.addLog("Registration failed: WiFi not connected");
     return false;
   }
 
-  HTTPClient http;
-  String url = apiUrl + "/api/devices/register";
-
-  http.setTimeout(HTTP_REQUEST_TIMEOUT);
-
-  bool beginSuccess = useHttps ? http.begin(wifiClientSecure, url) : http.begin(wifiClient, url);
-  if (!beginSuccess) {
+  int httpCode = HTTPC_ERROR_CONNECTION_FAILED;
+  JsonDocument responseDoc;
+  DeserializationError error = DeserializationError::EmptyInput;
+  sendRequest(http, API_ENDPOINT_COUNT, "POST", "/api/devices/register", &doc, [&](int code, const char* body, size_t length) {
+    httpCode = code;
+    error = parseResponse(responseDoc, body, length);
+  }, true);
+  http.wait();
+  if (httpCode == HTTPC_ERROR_CONNECTION_FAILED) {
     logger.addLog("Registration failed: HTTP connection error");
     return false;
   }
 
-  http.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("Accept", "application/json");
-  http.addHeader("X-API-Key", API_KEY);
-
-  int httpCode = http.POST(jsonPayload);
-
-  String response = "";
-  if (httpCode > 0) {
-    response = http.getString();
-  }
-
-  if (httpCode > 0 && (httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_CREATED)) {
-    http.end();
-
-    JsonDocument responseDoc;
-    DeserializationError error = deserializeJson(responseDoc, response);
-
+  if (httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_CREATED) {
     if (!error && responseDoc.containsKey("device_id") && responseDoc.containsKey("token")) {
       deviceId = responseDoc["device_id"];
       String token = responseDoc["token"].as<String>();
       saveToken(token);
+      buildRequestPrefixes();
       logger.addLog("Registered as device ID: " + String(deviceId));
       return true;
     } else {
@@ -110,7 +125,6 @@ bool ApiClient::registerDevice(const String& hostname, const String& macAddress,
     }
   } else {
     logger.addLog("Registration failed: HTTP " + String(httpCode));
-    http.end();
   }
 
   return false;
@@ -121,279 +135,649 @@ bool ApiClient::sendHeartbeat() {
     return false;
   }
 
-  JsonDocument doc;
-  doc["ip_address"] = WiFi.localIP().toString();
+  IPAddress addr = WiFi.localIP();
+  char ip[16];
+  snprintf(ip, sizeof(ip), "%u.%u.%u.%u", addr[0], addr[1], addr[2], addr[3]);
 
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
+  JsonDocument doc(&docArena);
+  doc["ip_address"] = ip;
 
-  String response;
-  String endpoint = "/api/devices/" + String(deviceId) + "/heartbeat";
+  char path[API_PATH_MAX];
+  snprintf(path, sizeof(path), "%s/heartbeat", devicePath.c_str());
 
-  return makePostRequest(endpoint, jsonPayload, response);
+  return makePostRequest(API_HEARTBEAT, path, doc, [this](int httpCode, const char* body, size_t length) {
+    if (httpCode == HTTP_CODE_OK) handleSync(body, length);
+  });
 }
 
-bool ApiClient::sendTemperatureReading(float temperature, int sensorId) {
+bool ApiClient::pollCommands() {
   if (deviceId <= 0) {
     return false;
   }
 
-  JsonDocument doc;
-  doc["temperature"] = temperature;
-  doc["sensor_id"] = sensorId;
-
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
-
-  String response;
-  String endpoint = "/api/devices/" + String(deviceId) + "/temperature";
-
-  return makePostRequest(endpoint, jsonPayload, response);
-}
-
-bool ApiClient::sendRelayState(int relayNumber, bool state, const String& mode, float tempOn, float tempOff, const String& name) {
-  if (deviceId <= 0) {
+  if (!commandConnectionAffordable()) {
     return false;
   }
 
-  JsonDocument doc;
-  doc["relay_number"] = relayNumber;
-  doc["state"] = state;
-  doc["mode"] = mode;
-  doc["temp_on"] = tempOn;
-  doc["temp_off"] = tempOff;
-  if (name.length() > 0) {
-    doc["name"] = name;
+  // Blocking, once: a server that takes 512-byte records lets the poll's
+  // TLS context use TLS_COMMAND_BUFFER each way instead of the full sizes
+  if (useHttps && !commandBuffersProbed) {
+    commandBuffersProbed = true;
+    if (WiFiClientSecure::probeMaxFragmentLength(commandHttp.getHost(), commandHttp.getPort(), TLS_COMMAND_BUFFER)) {
+      commandClientSecure.setBufferSizes(TLS_COMMAND_BUFFER, TLS_COMMAND_BUFFER);
+      logger.addLog("Command connection: server takes " + String(TLS_COMMAND_BUFFER) + "B TLS records");
+    } else {
+      logger.addLog("Command connection: no max fragment length support, full TLS buffers");
+    }
   }
 
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
+  char path[API_PATH_MAX];
+  snprintf(path, sizeof(path), "%s/commands/pending?wait=%d", devicePath.c_str(), API_COMMAND_WAIT);
 
-  String response;
-  String endpoint = "/api/devices/" + String(deviceId) + "/relay-state";
+  return makeGetRequest(API_COMMANDS, path, [this](int httpCode, const char* body, size_t length) {
+    if (httpCode != HTTP_CODE_OK) return;
+    if (!bothOpenLogged && http.connected()) {
+      bothOpenLogged = true;
+      logger.addLog("Heap with both backend connections open: " + String(ESP.getFreeHeap()) + "B free, largest block "
+                    + String(ESP.getMaxFreeBlockSize()) + "B");
+    }
+    handleSync(body, length);
+  });
+}
 
-  if (makePostRequest(endpoint, jsonPayload, response)) {
+// Over HTTPS the poll's connection is a second TLS context. It's opened
+// only with API_COMMAND_OPEN_HEAP free and dropped below
+// API_COMMAND_KEEP_HEAP; meanwhile commands come with sync responses.
+bool ApiClient::commandConnectionAffordable() {
+  if (!useHttps) return true;
+
+  uint32_t freeHeap = ESP.getFreeHeap();
+  bool open = commandHttp.connected();
+  if (freeHeap >= (open ? API_COMMAND_KEEP_HEAP : API_COMMAND_OPEN_HEAP)) {
+    if (commandHeapLow) {
+      commandHeapLow = false;
+      logger.addLog("Command poll resumed (" + String(freeHeap) + "B free)");
+    }
     return true;
   }
 
+  if (open) commandClientSecure.stop();
+  if (!commandHeapLow) {
+    commandHeapLow = true;
+    logger.addLog("WARN: Low heap (" + String(freeHeap) + "B), command poll paused; commands come with sync responses");
+  }
   return false;
 }
 
-bool ApiClient::pollCommands() {
-  if (deviceId <= 0) {
-    return false;
-  }
-
-  String response;
-  String endpoint = "/api/devices/" + String(deviceId) + "/commands/pending";
-
-  if (makeGetRequest(endpoint, response)) {
-    JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, response);
-
-    if (!error && doc.containsKey("commands")) {
-      JsonArray commands = doc["commands"].as<JsonArray>();
-      pendingCommandCount = 0;
+// Commands arrive from the long poll and from sync responses, and stay
+// pending on the backend until their status update has gone out, so the
+// same one can show up several times. IDs only grow: anything at or below
+// the last one queued is a repeat.
+void ApiClient::enqueueCommands(JsonArrayConst commands) {
+  int received = 0;
+
+  for (JsonObjectConst cmd : commands) {
+    int id = cmd["id"] | 0;
+    if (id <= lastCommandId) continue;
+
+    // Make room by dropping the already-processed head
+    if (nextCommandIdx > 0) {
+      for (int i = nextCommandIdx; i < pendingCommandCount; i++) {
+        pendingCommands[i - nextCommandIdx] = pendingCommands[i];
+      }
+      pendingCommandCount -= nextCommandIdx;
       nextCommandIdx = 0;
+    }
+    if (pendingCommandCount >= MAX_PENDING_COMMANDS) break;  // the rest comes again later
 
-      for (JsonObject cmd : commands) {
-        if (pendingCommandCount >= MAX_PENDING_COMMANDS) break;
-
-        pendingCommands[pendingCommandCount].id = cmd["id"];
-        pendingCommands[pendingCommandCount].type = cmd["type"].as<String>();
+    Command& c = pendingCommands[pendingCommandCount];
+    c.id = id;
+    c.type = commandTypeFromString(cmd["type"] | "");
+    if (c.type == CMD_SET_SCHEDULE && scheduleQueued) break;  // likewise
+    c.isValid = decodeCommand(cmd["params"], c);
+    pendingCommandCount++;
 
-        String paramsStr;
-        serializeJson(cmd["params"], paramsStr);
-        pendingCommands[pendingCommandCount].params = paramsStr;
-        pendingCommands[pendingCommandCount].isValid = true;
+    lastCommandId = id;
+    received++;
+  }
 
-        pendingCommandCount++;
-      }
+  if (received > 0) {
+    logger.addLog("Received " + String(received) + " pending commands");
+  }
+}
 
-      if (pendingCommandCount > 0) {
-        logger.addLog("Received " + String(pendingCommandCount) + " pending commands");
+// Fills in the typed fields for c.type. Missing values decode like they
+// used to read from the params JSON (0 / false), so a command without a
+// valid relay_number fails when it runs.
+bool ApiClient::decodeCommand(JsonObjectConst params, Command& c) {
+  c.relay = params["relay_number"] | 0;
+
+  switch (c.type) {
+    case CMD_SET_RELAY_MODE: {
+      const char* mode = params["mode"] | "";
+      c.mode = strcmp(mode, "MANUAL_ON") == 0 ? MANUAL_ON
+             : strcmp(mode, "MANUAL_OFF") == 0 ? MANUAL_OFF
+             : strcmp(mode, "PID") == 0 ? PID
+             : AUTO;
+      return true;
+    }
+    case CMD_SET_THRESHOLDS:
+      c.thresholds.on = params["temp_on"] | 0.0f;
+      c.thresholds.off = params["temp_off"] | 0.0f;
+      return true;
+    case CMD_SET_PID:
+      c.pid.kp = params["kp"] | NAN;
+      c.pid.ki = params["ki"] | NAN;
+      c.pid.kd = params["kd"] | NAN;
+      c.pid.window = params["window"] | 0;
+      return true;
+    case CMD_SET_SCHEDULE: {
+      String error;
+      if (!ScheduleManager::parseJson(params, scheduleEntries, c.scheduleCount, error)) {
+        logger.addLog("Schedule rejected: " + error);
+        return false;
       }
-
+      scheduleQueued = true;
+      return true;
+    }
+    case CMD_SET_RELAY_TYPE: {
+      const char* type = params["relay_type"] | "";
+      c.relayType = strcmp(type, "COOLING") == 0 ? COOLING
+                  : strcmp(type, "GENERIC") == 0 ? GENERIC
+                  : strcmp(type, "MANUAL_ONLY") == 0 ? MANUAL_ONLY
+                  : HEATING;
       return true;
     }
+    case CMD_SET_FREQUENCY:
+      c.frequency = params["frequency"] | 0;
+      return true;
+    case CMD_SET_UNIT:
+      c.useFahrenheit = params["use_fahrenheit"] | false;
+      return true;
+    case CMD_RESTART:
+      return true;
+    default:
+      return false;
   }
-
-  return false;
 }
 
-bool ApiClient::updateCommandStatus(int commandId, const String& status, const String& result) {
-  if (deviceId <= 0) {
-    return false;
-  }
+static const char* const COMMAND_TYPE_NAMES[] = {
+  "unknown", "set_relay_mode", "set_thresholds", "set_pid", "set_schedule",
+  "set_relay_type", "set_frequency", "set_unit", "restart"
+};
+
+const char* ApiClient::commandTypeName(CommandType t) {
+  return t <= CMD_RESTART ? COMMAND_TYPE_NAMES[t] : COMMAND_TYPE_NAMES[CMD_UNKNOWN];
+}
 
-  JsonDocument doc;
-  doc["status"] = status;
-  if (result.length() > 0) {
-    doc["result"]["message"] = result;
+ApiClient::CommandType ApiClient::commandTypeFromString(const char* name) {
+  for (uint8_t t = CMD_UNKNOWN + 1; t <= CMD_RESTART; t++) {
+    if (strcmp(name, COMMAND_TYPE_NAMES[t]) == 0) return (CommandType)t;
   }
+  return CMD_UNKNOWN;
+}
 
-  String jsonPayload;
-  serializeJson(doc, jsonPayload);
+// Only the filtered fields are kept, in docArena
+void ApiClient::handleSync(const char* body, size_t length) {
+  JsonDocument doc(&docArena);
+  if (parseResponse(doc, body, length, &syncFilter)) return;
 
-  String response;
-  String endpoint = "/api/devices/" + String(deviceId) + "/commands/" + String(commandId);
+  enqueueCommands(doc["commands"].as<JsonArrayConst>());
 
-  if (makePutRequest(endpoint, jsonPayload, response)) {
-    logger.addLog("Command " + String(commandId) + " status updated to: " + status);
-    return true;
+  uint32_t version = doc["config_version"] | 0;
+  JsonObjectConst config = doc["config"];
+  if (!config.isNull() && version > configVersion && !(configPending && desiredConfig.version == version)) {
+    desiredConfig.version = version;
+    desiredConfig.updateFrequency = config["update_frequency"] | 0;
+    desiredConfig.useFahrenheit = config["use_fahrenheit"] | false;
+    configPending = true;
   }
+}
 
-  return false;
+bool ApiClient::takeConfigUpdate(DesiredConfig& config) {
+  if (!configPending) return false;
+  configPending = false;
+  configVersion = desiredConfig.version;
+  config = desiredConfig;
+  return true;
 }
 
-bool ApiClient::makePostRequest(const String& endpoint, const String& jsonPayload, String& response) {
-  if (WiFi.status() != WL_CONNECTED) {
-    logger.addLog("WiFi not connected");
+// A result longer than API_STATUS_RESULT_MAX is cut short.
+bool ApiClient::updateCommandStatus(int commandId, const char* status, const char* result) {
+  if (deviceId <= 0) {
     return false;
   }
-
-  if (authToken.length() == 0) {
-    logger.addLog("ERROR: No auth token for request!");
+  if (statusCount >= MAX_STATUS_UPDATES) {
+    logger.addLog("ERROR: Status queue full, dropping command " + String(commandId) + " " + status);
     return false;
   }
 
-  HTTPClient http;
-  String url = apiUrl + endpoint;
+  StatusUpdate& u = statusUpdates[(statusHead + statusCount) % MAX_STATUS_UPDATES];
+  u.commandId = commandId;
+  strlcpy(u.status, status, sizeof(u.status));
+  strlcpy(u.result, result, sizeof(u.result));
+  statusCount++;
+  return true;
+}
 
-  // Use appropriate client based on protocol
-  if (useHttps) {
-    http.begin(wifiClientSecure, url);
-  } else {
-    http.begin(wifiClient, url);
+// Sends the oldest queued update. It stays queued, to be retried on a later
+// pass, unless the backend took it (2xx) or rejected it for good (4xx).
+bool ApiClient::sendStatusUpdate() {
+  if (statusCount == 0) {
+    return false;
   }
 
-  // Set timeout and follow redirects
-  http.setTimeout(HTTP_REQUEST_TIMEOUT);
-  http.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
+  const StatusUpdate& u = statusUpdates[statusHead];
+  JsonDocument doc(&docArena);
+  doc["status"] = u.status;
+  if (u.result[0]) {
+    doc["result"]["message"] = u.result;
+  }
 
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("Accept", "application/json");
-  http.addHeader("Authorization", "Bearer " + authToken);
+  char path[API_PATH_MAX];
+  snprintf(path, sizeof(path), "%s/commands/%d", devicePath.c_str(), u.commandId);
 
-  int httpCode = http.POST(jsonPayload);
+  return makePutRequest(API_COMMAND_STATUS, path, doc, [this](int httpCode, const char*, size_t) {
+    if (httpCode < 200 || httpCode >= 500) return;
+    StatusUpdate& sent = statusUpdates[statusHead];
+    if (httpCode == HTTP_CODE_OK) {
+      char line[64];
+      snprintf(line, sizeof(line), "Command %d status updated to: %s", sent.commandId, sent.status);
+      logger.addLog(line);
+    }
+    statusHead = (statusHead + 1) % MAX_STATUS_UPDATES;
+    statusCount--;
+  });
+}
 
-  // Combined log: endpoint and response code
-  logger.addLog("POST " + endpoint + " : " + String(httpCode));
+void ApiClient::buildRequestPrefixes() {
+  devicePath = "/api/devices/" + String(deviceId);
+  authHeader = "Authorization: Bearer " + authToken + "\r\n";
+}
 
-  if (httpCode == -5) {
-    logger.addLog("ERROR: Connection timeout");
+// Starts one request on one of the persistent connections (see
+// AsyncHttpClient). Returns false if another request is still in flight on
+// it, or if it has a payload and the other connection is reading a
+// response into ioBuffer; the caller tries again on a later pass.
+//
+// Payloads go out as MessagePack once the backend has answered in it (we
+// always offer it in Accept), as JSON until then, so an older backend keeps
+// working. Either way the payload is encoded straight into ioBuffer, which
+// the client keeps claimed until its response has been handled. Headers go
+// on the stack and the request head into the client's own buffer: nothing
+// here touches the heap.
+bool ApiClient::sendRequest(AsyncHttpClient& client, ApiEndpoint api, const char* method, const char* path,
+                            const JsonDocument* payload, ResponseHandler done, bool withApiKey) {
+  if (client.busy()) return false;
+
+  size_t length = 0;
+  if (payload) {
+    size_t size = encodedSize(*payload);
+    if (size > sizeof(ioBuffer)) {
+      logger.addLog(String("ERROR: ") + path + " payload too large (" + String(size) + "B)");
+      return false;
+    }
+    if (!io.claim(&client)) return false;
+    length = useMsgPack ? serializeMsgPack(*payload, (uint8_t*)ioBuffer, sizeof(ioBuffer))
+                        : serializeJson(*payload, ioBuffer, sizeof(ioBuffer));
+    io.used(length);
+  }
+
+  const char* contentType = !payload ? ""
+                          : useMsgPack ? "Content-Type: application/msgpack\r\n"
+                          : "Content-Type: application/json\r\n";
+  char headers[HTTP_REQUEST_HEAD];
+  int n;
+  if (withApiKey) {
+    n = snprintf(headers, sizeof(headers), "%sAccept: application/msgpack, application/json;q=0.5\r\nX-API-Key: %s\r\n",
+                 contentType, API_KEY);
+  } else {
+    n = snprintf(headers, sizeof(headers), "%sAccept: application/msgpack, application/json;q=0.5\r\n%sX-Config-Version: %u\r\n",
+                 contentType, authHeader.c_str(), (unsigned int)configVersion);
   }
 
-  if (httpCode > 0) {
-    response = http.getString();
-    http.end();
-    return (httpCode == HTTP_CODE_OK || httpCode == HTTP_CODE_CREATED);
+  if (n < 0 || (size_t)n >= sizeof(headers)) {
+    io.release(&client);
+    logger.addLog(String("ERROR: ") + method + " " + path + " request headers too long");
+    return false;
   }
 
-  http.end();
-  return false;
+  InFlight& r = inFlightFor(client);
+  r.api = api;
+  r.method = method;
+  strlcpy(r.path, path, sizeof(r.path));
+  r.done = std::move(done);
+  // Not busy (checked above), so only an oversized request head can fail here
+  if (!client.start(method, path, headers, payload ? (const uint8_t*)ioBuffer : nullptr, length,
+                    [this, &client](int httpCode, const char* body, size_t bodyLength) {
+                      onResponse(client, httpCode, body, bodyLength);
+                    })) {
+    r.done = nullptr;
+    io.release(&client);
+    logger.addLog(String("ERROR: ") + method + " " + path + " request line and headers exceed HTTP_REQUEST_HEAD");
+    return false;
+  }
+  return true;
 }
 
-bool ApiClient::makeGetRequest(const String& endpoint, String& response) {
-  if (WiFi.status() != WL_CONNECTED || authToken.length() == 0) {
-    return false;
+void ApiClient::onResponse(AsyncHttpClient& client, int httpCode, const char* body, size_t length) {
+  InFlight& r = inFlightFor(client);
+  // The handler may start the next request on this connection
+  ResponseHandler done = std::move(r.done);
+  r.done = nullptr;
+
+  // Too big for the receive buffer. An upload or heartbeat still went
+  // through and the poll brings the commands its response would have
+  // carried; a poll or registration without its body has failed.
+  if (!body && httpCode > 0) {
+    char line[API_PATH_MAX + 48];
+    snprintf(line, sizeof(line), "WARN: %s %s : response too large for its buffer", r.method, r.path);
+    logger.addLog(line);
+    if (r.api == API_COMMANDS || r.api == API_ENDPOINT_COUNT) httpCode = HTTPC_ERROR_TOO_LESS_RAM;
+  }
+
+  responseMsgPack = strncmp(client.getContentType(), "application/msgpack", 19) == 0;
+  if (responseMsgPack && !useMsgPack) {
+    useMsgPack = true;
+    logger.addLog("Backend speaks MessagePack, switching payloads to it");
+  }
+
+  if (r.api < API_ENDPOINT_COUNT) {
+    recordResult(r.api, httpCode);
+
+    // Combined log: endpoint and response code. Polls only log errors.
+    bool isGet = strcmp(r.method, "GET") == 0;
+    if (!isGet || httpCode <= 0 || httpCode >= 400) {
+      char line[API_PATH_MAX + 24];
+      snprintf(line, sizeof(line), "%s %s : %d", r.method, r.path, httpCode);
+      logger.addLog(line);
+    }
+    if (!isGet && httpCode == HTTPC_ERROR_CONNECTION_LOST) {
+      logger.addLog("ERROR: Connection lost");
+    }
   }
 
-  HTTPClient http;
-  String url = apiUrl + endpoint;
+  if (done) done(httpCode, body, length);
+}
 
-  // Use appropriate client based on protocol
-  if (useHttps) {
-    http.begin(wifiClientSecure, url);
-  } else {
-    http.begin(wifiClient, url);
+// Bytes the payload takes in the current encoding (JSON needs room for the
+// terminating NUL serializeJson writes)
+size_t ApiClient::encodedSize(const JsonDocument& doc) const {
+  return useMsgPack ? measureMsgPack(doc) : measureJson(doc) + 1;
+}
+
+// Drops trailing batch items until the payload fits ioBuffer; they stay
+// queued for the next batch. If docArena ran out, the item that was being
+// built may be incomplete, so the last one goes too. Returns how many are
+// left.
+size_t ApiClient::fitBatch(const JsonDocument& doc, JsonArray items) const {
+  if (doc.overflowed() && items.size() > 1) items.remove(items.size() - 1);
+  while (items.size() > 1 && encodedSize(doc) > sizeof(ioBuffer)) {
+    items.remove(items.size() - 1);
   }
+  return items.size();
+}
+
+// Parses a response body in whichever encoding it came in, keeping only
+// what `filter` selects if one is given. Only valid inside a response
+// handler; a missing (oversized) body is EmptyInput.
+DeserializationError ApiClient::parseResponse(JsonDocument& doc, const char* body, size_t length,
+                                              JsonDocument* filter) const {
+  if (!body) return DeserializationError::EmptyInput;
+  if (filter) {
+    DeserializationOption::Filter only(*filter);
+    return responseMsgPack ? deserializeMsgPack(doc, body, length, only)
+                           : deserializeJson(doc, body, length, only);
+  }
+  return responseMsgPack ? deserializeMsgPack(doc, body, length)
+                         : deserializeJson(doc, body, length);
+}
 
-  // Set timeout and follow redirects
-  http.setTimeout(HTTP_REQUEST_TIMEOUT);
-  http.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
+const char* ApiClient::endpointName(ApiEndpoint e) {
+  switch (e) {
+    case API_READINGS: return "readings";
+    case API_RELAY_STATES: return "relayStates";
+    case API_HEARTBEAT: return "heartbeat";
+    case API_COMMANDS: return "commands";
+    case API_COMMAND_STATUS: return "commandStatus";
+    default: return "unknown";
+  }
+}
 
-  http.addHeader("Accept", "application/json");
-  http.addHeader("Authorization", "Bearer " + authToken);
+// Only trouble on the backend's side counts: no connection, a timeout, 5xx
+// or 429. Any other answer means it's up, even if it rejected the request.
+void ApiClient::recordResult(ApiEndpoint e, int httpCode) {
+  CircuitBreaker& b = breakers[e];
+  bool failed = httpCode <= 0 || httpCode >= 500 || httpCode == 429;
+  if (!failed) {
+    if (b.getFailures() >= BREAKER_THRESHOLD) {
+      logger.addLog(String("Backend ") + endpointName(e) + " recovered, breaker closed");
+    }
+    b.recordSuccess();
+    return;
+  }
 
-  int httpCode = http.GET();
+  unsigned long now = millis();
+  b.recordFailure(now);
+  if (b.getFailures() >= BREAKER_THRESHOLD) {
+    logger.addLog(String("Backend ") + endpointName(e) + " breaker open after " + String(b.getFailures())
+                  + " failures, next try in " + String(b.getRetryIn(now) / 1000) + "s");
+  }
+}
 
-  // Only log errors, not successful polling
-  if (httpCode <= 0 || httpCode >= 400) {
-    logger.addLog("GET " + endpoint + " : " + String(httpCode));
+bool ApiClient::makePostRequest(ApiEndpoint api, const char* path, const JsonDocument& payload,
+                                ResponseHandler done) {
+  if (WiFi.status() != WL_CONNECTED) {
+    logger.addLog("WiFi not connected");
+    return false;
   }
 
-  if (httpCode > 0) {
-    response = http.getString();
-    http.end();
-    return (httpCode == HTTP_CODE_OK);
+  if (authToken.length() == 0) {
+    logger.addLog("ERROR: No auth token for request!");
+    return false;
   }
 
-  http.end();
-  return false;
+  return sendRequest(clientFor(api), api, "POST", path, &payload, std::move(done));
 }
 
-bool ApiClient::makePutRequest(const String& endpoint, const String& jsonPayload, String& response) {
+bool ApiClient::makeGetRequest(ApiEndpoint api, const char* path, ResponseHandler done) {
   if (WiFi.status() != WL_CONNECTED || authToken.length() == 0) {
     return false;
   }
 
-  HTTPClient http;
-  String url = apiUrl + endpoint;
+  return sendRequest(clientFor(api), api, "GET", path, nullptr, std::move(done));
+}
 
-  // Use appropriate client based on protocol
-  if (useHttps) {
-    http.begin(wifiClientSecure, url);
-  } else {
-    http.begin(wifiClient, url);
+bool ApiClient::makePutRequest(ApiEndpoint api, const char* path, const JsonDocument& payload,
+                               ResponseHandler done) {
+  if (WiFi.status() != WL_CONNECTED || authToken.length() == 0) {
+    return false;
   }
 
-  // Set timeout and follow redirects
-  http.setTimeout(HTTP_REQUEST_TIMEOUT);
-  http.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
+  return sendRequest(clientFor(api), api, "PUT", path, &payload, std::move(done));
+}
 
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("Accept", "application/json");
-  http.addHeader("Authorization", "Bearer " + authToken);
+// ---- Outbox ----
 
-  int httpCode = http.PUT(jsonPayload);
+// Same convention as the temperature log: unix seconds once NTP has synced,
+// seconds since boot before that.
+uint32_t ApiClient::queueTimestamp() {
+  time_t now = time(nullptr);
+  return now >= 1000000000 ? (uint32_t)now : millis() / 1000;
+}
 
-  // Combined log: endpoint and response code
-  logger.addLog("PUT " + endpoint + " : " + String(httpCode));
+// Epoch seconds to upload for a queued timestamp, or 0 if it can't be known
+// (the backend then uses its own clock). Boot-relative ones from this boot
+// are converted once NTP has synced.
+uint32_t ApiClient::uploadTimestamp(uint32_t queued, bool previousBoot) {
+  if (queued >= 1000000000) return queued;
+  time_t now = time(nullptr);
+  if (previousBoot || now < 1000000000) return 0;
+  return now - (millis() / 1000 - queued);
+}
 
-  if (httpCode > 0) {
-    response = http.getString();
-    http.end();
-    return (httpCode == HTTP_CODE_OK);
+void ApiClient::noteQueued(const TimeSeriesStore& store) {
+  if (store.size() < store.getCapacity()) return;
+  if (!outboxFullLogged) {
+    logger.addLog("WARN: Outbox full, overwriting oldest entries");
+    outboxFullLogged = true;
   }
+}
 
-  http.end();
-  return false;
+void ApiClient::queueReading(float temperature, int sensorId) {
+  if (readings.size() == 0) readingsSince = millis();
+  TempRecord rec;
+  rec.timestamp = queueTimestamp();
+  rec.centiC = TimeSeriesStore::toCenti(temperature);
+  rec.sensorId = (uint8_t)sensorId;
+  rec.reserved = 0;
+  readings.append(&rec);
+  noteQueued(readings);
 }
 
-// ---- Dirty-flag drain interface ----
+void ApiClient::queueRelayState(const Relays& relays, int relayIdx) {
+  const PidSettings& pid = relays.getPidSettings(relayIdx);
+  RelayRecord rec;
+  rec.timestamp  = queueTimestamp();
+  rec.relay      = relayIdx;
+  rec.flags      = (relays.getRelayState(relayIdx) ? RELAY_RECORD_ON : 0)
+                 | (relays.isDeferred(relayIdx) ? RELAY_RECORD_DEFERRED : 0)
+                 | (relays.getDeferredState(relayIdx) ? RELAY_RECORD_DEFER_ON : 0);
+  rec.mode       = relays.getRelayMode(relayIdx);
+  rec.reserved   = 0;
+  rec.tempOnC    = TimeSeriesStore::toCenti(relays.getTempOn(relayIdx));
+  rec.tempOffC   = TimeSeriesStore::toCenti(relays.getTempOff(relayIdx));
+  rec.kp         = pid.kp;
+  rec.ki         = pid.ki;
+  rec.kd         = pid.kd;
+  rec.windowSec  = pid.windowSec;
+  rec.duty       = (uint16_t)lroundf(relays.getPidOutput(relayIdx) * 10000);
+  rec.deferredIn = relays.getDeferredRemaining(relayIdx);
+  relayStates.append(&rec);
+  relayStates.flush();  // rare, and the ones worth keeping across a reset
+  lastRelayQueued = millis();
+  noteQueued(relayStates);
+}
 
-void ApiClient::markRelayDirty(int relayIdx) {
-  if (relayIdx >= 0 && relayIdx < 4) relayDirty[relayIdx] = true;
+// Relay type and cycle limits aren't part of the backend's relay state, so
+// changes to only those don't need a sync.
+void ApiClient::onRelayEvent(const RelayEvent& e, const Relays& relays) {
+  const uint8_t synced = RELAY_CHANGED_STATE | RELAY_CHANGED_DEFERRED | RELAY_CHANGED_MODE
+                       | RELAY_CHANGED_THRESHOLDS | RELAY_CHANGED_PID;
+  if (e.changes & synced) queueRelayState(relays, e.index);
 }
 
-void ApiClient::clearRelayDirty(int relayIdx) {
-  if (relayIdx >= 0 && relayIdx < 4) relayDirty[relayIdx] = false;
+bool ApiClient::readingsDue(unsigned long now) const {
+  uint32_t n = readings.size();
+  return n > 0
+      && now - lastUpload >= OUTBOX_DRAIN_INTERVAL
+      && breakers[API_READINGS].allow(now)
+      && (n >= TELEMETRY_BATCH_READINGS || now - readingsSince >= TELEMETRY_FLUSH_INTERVAL);
 }
 
-int ApiClient::nextDirtyRelay() const {
-  for (int i = 0; i < 4; i++) {
-    if (relayDirty[i]) return i;
+// Waits for the burst to settle, so e.g. a mode change and the switch it
+// causes go up together.
+bool ApiClient::relayStatesDue(unsigned long now) const {
+  uint32_t n = relayStates.size();
+  return n > 0
+      && now - lastUpload >= OUTBOX_DRAIN_INTERVAL
+      && breakers[API_RELAY_STATES].allow(now)
+      && (n >= OUTBOX_RELAY_BATCH || now - lastRelayQueued >= RELAY_FLUSH_DELAY);
+}
+
+bool ApiClient::flushReadings() {
+  if (deviceId <= 0 || readings.size() == 0) {
+    return false;
+  }
+  lastUpload = millis();
+
+  TempRecord batch[OUTBOX_READINGS_BATCH];
+  uint32_t seq = readings.firstSeq();
+  size_t n = readings.read(0, batch, OUTBOX_READINGS_BATCH);
+
+  JsonDocument doc(&docArena);
+  JsonArray items = doc["readings"].to<JsonArray>();
+  for (size_t i = 0; i < n && !doc.overflowed(); i++) {
+    JsonObject item = items.add<JsonObject>();
+    item["temperature"] = TimeSeriesStore::fromCenti(batch[i].centiC);
+    item["sensor_id"] = batch[i].sensorId;
+    uint32_t at = uploadTimestamp(batch[i].timestamp, seq + i < readingsCarried);
+    if (at) item["recorded_at"] = at;
+  }
+  n = fitBatch(doc, items);
+
+  char path[API_PATH_MAX];
+  snprintf(path, sizeof(path), "%s/temperature/batch", devicePath.c_str());
+
+  // A full outbox may overwrite the head of the batch while the request is
+  // in flight, so drop by sequence number: only what is left of it goes
+  uint32_t end = seq + n;
+  return makePostRequest(API_READINGS, path, doc, [this, end](int httpCode, const char* body, size_t length) {
+    if (httpCode != HTTP_CODE_OK && httpCode != HTTP_CODE_CREATED) return;
+    readings.dropBefore(end);
+    outboxFullLogged = false;
+    handleSync(body, length);
+  });
+}
+
+bool ApiClient::flushRelayStates() {
+  if (deviceId <= 0 || relayStates.size() == 0) {
+    return false;
+  }
+  lastUpload = millis();
+
+  RelayRecord batch[OUTBOX_RELAY_BATCH];
+  uint32_t seq = relayStates.firstSeq();
+  size_t n = relayStates.read(0, batch, OUTBOX_RELAY_BATCH);
+
+  JsonDocument doc(&docArena);
+  JsonArray items = doc["states"].to<JsonArray>();
+  for (size_t i = 0; i < n && !doc.overflowed(); i++) {
+    const RelayRecord& rec = batch[i];
+    Mode mode = (Mode)rec.mode;
+    JsonObject item = items.add<JsonObject>();
+    item["relay_number"] = rec.relay + 1;
+    item["state"] = (rec.flags & RELAY_RECORD_ON) != 0;
+    item["mode"] = Relays::modeToString(mode);
+    item["temp_on"] = TimeSeriesStore::fromCenti(rec.tempOnC);
+    item["temp_off"] = TimeSeriesStore::fromCenti(rec.tempOffC);
+    // pid/duty are only sent in PID mode
+    if (mode == PID) {
+      item["pid_kp"] = rec.kp;
+      item["pid_ki"] = rec.ki;
+      item["pid_kd"] = rec.kd;
+      item["pid_window"] = rec.windowSec;
+      item["duty"] = rec.duty / 10000.0f;
+    }
+    if (rec.flags & RELAY_RECORD_DEFERRED) {
+      item["deferred_state"] = (rec.flags & RELAY_RECORD_DEFER_ON) != 0;
+      item["deferred_in"] = rec.deferredIn;
+    }
+    uint32_t at = uploadTimestamp(rec.timestamp, seq + i < relayStatesCarried);
+    if (at) item["changed_at"] = at;
   }
-  return -1;
+  n = fitBatch(doc, items);
+
+  char path[API_PATH_MAX];
+  snprintf(path, sizeof(path), "%s/relay-state/batch", devicePath.c_str());
+
+  uint32_t end = seq + n;
+  return makePostRequest(API_RELAY_STATES, path, doc, [this, end](int httpCode, const char* body, size_t length) {
+    if (httpCode != HTTP_CODE_OK && httpCode != HTTP_CODE_CREATED) return;
+    relayStates.dropBefore(end);
+    outboxFullLogged = false;
+    handleSync(body, length);
+  });
 }
 
-void ApiClient::markTempDirty() {
-  tempDirty = true;
+void ApiClient::flushOutbox() {
+  readings.flush();
+  relayStates.flush();
 }
 
-void ApiClient::clearTempDirty() {
-  tempDirty = false;
+void ApiClient::flushOutboxIfDue() {
+  readings.flushIfDue();
+  relayStates.flushIfDue();
 }
 
 ApiClient::Command* ApiClient::peekNextCommand() {
@@ -405,6 +789,8 @@ ApiClient::Command* ApiClient::peekNextCommand() {
 
 void ApiClient::popNextCommand() {
   if (nextCommandIdx < pendingCommandCount) {
+    const Command& done = pendingCommands[nextCommandIdx];
+    if (done.type == CMD_SET_SCHEDULE && done.isValid) scheduleQueued = false;
     nextCommandIdx++;
   }
   // Reset to clean state when fully drained so the next pollCommands
@@ -414,22 +800,3 @@ void ApiClient::popNextCommand() {
     pendingCommandCount = 0;
   }
 }
-
-bool ApiClient::relayStateMatchesLastSent(int relayIdx, bool state, const String& mode, float tempOn, float tempOff) const {
-  if (relayIdx < 0 || relayIdx >= 4) return false;
-  const RelaySnapshot& s = lastSent[relayIdx];
-  if (!s.valid) return false;
-  return s.state == state
-      && s.mode == mode
-      && fabs(s.tempOn  - tempOn)  < 0.01f
-      && fabs(s.tempOff - tempOff) < 0.01f;
-}
-
-void ApiClient::recordRelaySent(int relayIdx, bool state, const String& mode, float tempOn, float tempOff) {
-  if (relayIdx < 0 || relayIdx >= 4) return;
-  lastSent[relayIdx].valid   = true;
-  lastSent[relayIdx].state   = state;
-  lastSent[relayIdx].mode    = mode;
-  lastSent[relayIdx].tempOn  = tempOn;
-  lastSent[relayIdx].tempOff = tempOff;
-}
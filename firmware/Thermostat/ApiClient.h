@@ -3,85 +3,267 @@
 
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
-#include <ESP8266HTTPClient.h>
 #include <WiFiClient.h>
 #include <WiFiClientSecure.h>
 #include <ArduinoJson.h>
+#include "Config.h"
+#include "ArenaAllocator.h"
+#include "AsyncHttpClient.h"
+#include "CircuitBreaker.h"
+#include "RelayController.h"
+#include "ScheduleManager.h"
+#include "TimeSeriesStore.h"
 
+// One queued relay state in the outbox. 32 bytes.
+struct __attribute__((packed)) RelayRecord {
+  uint32_t timestamp;   // unix seconds, or seconds since boot before NTP sync
+  uint8_t  relay;
+  uint8_t  flags;       // RELAY_RECORD_* bits
+  uint8_t  mode;
+  uint8_t  reserved;
+  int16_t  tempOnC;     // 1/100 °C
+  int16_t  tempOffC;
+  float    kp;
+  float    ki;
+  float    kd;
+  uint16_t windowSec;
+  uint16_t duty;        // 1/10000
+  uint32_t deferredIn;  // seconds
+};
+
+constexpr uint8_t RELAY_RECORD_ON       = 1 << 0;
+constexpr uint8_t RELAY_RECORD_DEFERRED = 1 << 1;  // a transition is waiting on the cycle limits
+constexpr uint8_t RELAY_RECORD_DEFER_ON = 1 << 2;  // ...to ON
+
+// Backend endpoints with their own retry backoff / circuit breaker
+enum ApiEndpoint : uint8_t {
+  API_READINGS,
+  API_RELAY_STATES,
+  API_HEARTBEAT,
+  API_COMMANDS,
+  API_COMMAND_STATUS,
+  API_ENDPOINT_COUNT
+};
+
+// Talks to the backend one request at a time without blocking: the calls
+// below only start a request (returning false if they couldn't), poll()
+// advances it and the response is handled when it completes. Start a new
+// one only while !isBusy(). The command long poll runs on a second
+// connection of its own, so it never holds up uploads.
 class ApiClient {
 public:
   ApiClient(const String& apiUrl);
 
   void begin();
-  bool registerDevice(const String& hostname, const String& macAddress, const String& ipAddress, const String& firmwareVersion);
+  void poll() {
+    http.poll();
+    commandHttp.poll();
+  }
+  bool isBusy() const { return http.busy(); }
+  // Most of API_DOC_ARENA / API_IO_BUFFER used at once since boot
+  size_t getDocPeak() const { return docArena.getPeak(); }
+  size_t getIoPeak() const { return io.peak; }
+  bool isPollingCommands() const { return commandHttp.busy(); }
+
+  bool registerDevice(const String& hostname, const String& macAddress, const String& ipAddress, const String& firmwareVersion);  // blocking, setup() only
   bool sendHeartbeat();
-  bool sendTemperatureReading(float temperature, int sensorId = 0);
-  bool sendRelayState(int relayNumber, bool state, const String& mode, float tempOn, float tempOff, const String& name = "");
-  bool pollCommands();
-  bool updateCommandStatus(int commandId, const String& status, const String& result = "");
+  bool pollCommands();  // long poll; start another once !isPollingCommands()
+
+  // Status updates are queued and sent in order, one per sendStatusUpdate()
+  bool updateCommandStatus(int commandId, const char* status, const char* result = "");
+  bool hasStatusUpdates() const { return statusCount > 0; }
+  bool sendStatusUpdate();
 
   int getDeviceId() const { return deviceId; }
   bool isRegistered() const { return deviceId > 0; }
 
+  // False while the endpoint is backing off after failures (or its breaker
+  // is open). readingsDue()/relayStatesDue() already check this.
+  bool endpointReady(ApiEndpoint e, unsigned long now) const { return breakers[e].allow(now); }
+  const CircuitBreaker& getBreaker(ApiEndpoint e) const { return breakers[e]; }
+  static const char* endpointName(ApiEndpoint e);
+
+  enum CommandType : uint8_t {
+    CMD_UNKNOWN,
+    CMD_SET_RELAY_MODE,
+    CMD_SET_THRESHOLDS,
+    CMD_SET_PID,
+    CMD_SET_SCHEDULE,
+    CMD_SET_RELAY_TYPE,
+    CMD_SET_FREQUENCY,
+    CMD_SET_UNIT,
+    CMD_RESTART
+  };
+  static const char* commandTypeName(CommandType t);
+  static CommandType commandTypeFromString(const char* name);
+
+  // A command with its params decoded once, on arrival. `relay` is the
+  // 1-based relay_number as sent; it's range-checked when the command runs.
+  // A set_schedule's entries are kept in getScheduleEntries(), which holds
+  // one schedule, so a second waits in the backend for a later poll.
   struct Command {
     int id;
-    String type;
-    String params;
-    bool isValid;
+    CommandType type;
+    bool isValid;          // false: unknown type or rejected params
+    int relay;
+    union {
+      Mode mode;
+      RelayType relayType;
+      struct { float on, off; } thresholds;
+      struct { float kp, ki, kd; uint16_t window; } pid;  // NaN / 0 = keep current
+      uint8_t scheduleCount;
+      int frequency;
+      bool useFahrenheit;
+    };
   };
+  const ScheduleEntry* getScheduleEntries() const { return scheduleEntries; }
 
   Command* getPendingCommands() { return pendingCommands; }
   int getPendingCommandCount() const { return pendingCommandCount; }
 
-  // Drain-one-per-loop interface: web handlers and the loop tick mark state
-  // dirty; the main loop drains a single sync per iteration so the web server
-  // is never blocked behind a stack of HTTP calls.
-  void markRelayDirty(int relayIdx);
-  void clearRelayDirty(int relayIdx);
-  int  nextDirtyRelay() const;             // 0..3 of next dirty relay, or -1
-  void markTempDirty();
-  void clearTempDirty();
-  bool isTempDirty() const { return tempDirty; }
+  // Sync responses (heartbeat, uploads) also carry pending commands, which
+  // are queued like polled ones, and the backend's desired config version.
+  // A newer config is handed out once by takeConfigUpdate().
+  struct DesiredConfig {
+    uint32_t version;
+    int updateFrequency;
+    bool useFahrenheit;
+  };
+  void setConfigVersion(uint32_t version) { configVersion = version; }
+  bool takeConfigUpdate(DesiredConfig& config);
+
+  // Outbox: readings and relay states are queued on LittleFS with the time
+  // they happened and uploaded in batches, at most one per
+  // OUTBOX_DRAIN_INTERVAL. Entries stay queued until the backend
+  // acknowledges them, across reboots; when the outbox is full the oldest
+  // entries are overwritten. Relay states go to flash as they're queued;
+  // readings are staged in RAM for up to OUTBOX_STAGE_INTERVAL, so a power
+  // loss or watchdog reset can lose that much of them (a restart or OTA
+  // stages them first).
+  void queueReading(float temperature, int sensorId);
+  void queueRelayState(const Relays& relays, int relayIdx);
+  void onRelayEvent(const RelayEvent& e, const Relays& relays);
+  bool readingsDue(unsigned long now) const;
+  bool relayStatesDue(unsigned long now) const;
+  bool flushReadings();
+  bool flushRelayStates();
+  void flushOutbox();        // stage to flash, before a restart / OTA
+  void flushOutboxIfDue();
 
   bool hasPendingCommands() const { return nextCommandIdx < pendingCommandCount; }
   Command* peekNextCommand();
   void popNextCommand();
 
-  // Last-sent dedupe: avoids re-POSTing identical relay state. The drain
-  // logic asks whether the candidate matches what was last successfully sent
-  // and skips the network call if so. recordRelaySent() is called only after
-  // a 2xx response from the backend.
-  bool relayStateMatchesLastSent(int relayIdx, bool state, const String& mode, float tempOn, float tempOff) const;
-  void recordRelaySent(int relayIdx, bool state, const String& mode, float tempOn, float tempOff);
-
 private:
   String apiUrl;
   int deviceId;
   String authToken;
+  // Built once registered, so requests don't assemble them every time
+  String devicePath;             // "/api/devices/<id>"
+  String authHeader;             // "Authorization: Bearer <token>\r\n"
+  void buildRequestPrefixes();
   WiFiClient wifiClient;
   WiFiClientSecure wifiClientSecure;
+  BearSSL::Session tlsSession;   // resumed on reconnect, skipping the full handshake
   bool useHttps;
+  // Both connections' response bodies and http's encoded request payload.
+  // A request holds it from encoding until its response has been handled,
+  // a poll only while its body arrives (not while the backend holds it).
+  char ioBuffer[API_IO_BUFFER];
+  HttpBuffer io;
+  AsyncHttpClient http;          // keeps the socket open across requests
+  WiFiClient commandClient;
+  WiFiClientSecure commandClientSecure;
+  BearSSL::Session commandTlsSession;
+  AsyncHttpClient commandHttp;   // command long poll
+  bool commandBuffersProbed;     // MFLN asked for once, before the first poll
+  bool commandHeapLow;           // poll paused to free its TLS context
+  bool bothOpenLogged;
+  bool commandConnectionAffordable();
 
   static const int MAX_PENDING_COMMANDS = 10;
   Command pendingCommands[MAX_PENDING_COMMANDS];
   int pendingCommandCount;
   int nextCommandIdx;
+  int lastCommandId;
+  ScheduleEntry scheduleEntries[RELAY_COUNT * SCHEDULE_MAX_ENTRIES];
+  bool scheduleQueued;         // a pending set_schedule owns scheduleEntries
+  JsonDocument syncFilter;     // the response fields handleSync() reads
+  void enqueueCommands(JsonArrayConst commands);
+  bool decodeCommand(JsonObjectConst params, Command& c);
+  void handleSync(const char* body, size_t length);
+
+  uint32_t configVersion;      // reported in X-Config-Version
+  DesiredConfig desiredConfig;
+  bool configPending;
+
+  struct StatusUpdate {
+    int commandId;
+    char status[16];                      // "acknowledged", "completed", "failed"
+    char result[API_STATUS_RESULT_MAX];   // sent as result.message if not empty
+  };
+  static const int MAX_STATUS_UPDATES = 16;
+  StatusUpdate statusUpdates[MAX_STATUS_UPDATES];
+  int statusHead;
+  int statusCount;
+
+  TimeSeriesStore readings;      // TempRecord
+  TimeSeriesStore relayStates;   // RelayRecord
+  // Entries with a sequence number below these were queued before this
+  // boot; their boot-relative timestamps can't be converted any more.
+  uint32_t readingsCarried;
+  uint32_t relayStatesCarried;
+  unsigned long readingsSince;   // millis() when the reading queue became non-empty
+  unsigned long lastRelayQueued;
+  unsigned long lastUpload;
+  bool outboxFullLogged;
+
+  CircuitBreaker breakers[API_ENDPOINT_COUNT];
+  void recordResult(ApiEndpoint e, int httpCode);
 
-  bool relayDirty[4];
-  bool tempDirty;
+  static uint32_t queueTimestamp();
+  static uint32_t uploadTimestamp(uint32_t queued, bool previousBoot);
+  void noteQueued(const TimeSeriesStore& store);
 
-  struct RelaySnapshot {
-    bool valid;
-    bool state;
-    String mode;
-    float tempOn;
-    float tempOff;
+  // Called with the HTTP status (or a negative HTTPC_ERROR_* code) and body;
+  // the body is only valid during the call
+  typedef AsyncHttpClient::Callback ResponseHandler;
+
+  // The request in flight on each connection. Keeping it here means the
+  // callback handed to AsyncHttpClient captures only pointers and fits in
+  // std::function without a heap allocation; handlers passed in should
+  // capture no more than `this` and one word for the same reason.
+  struct InFlight {
+    ApiEndpoint api;             // API_ENDPOINT_COUNT: no breaker (registration)
+    const char* method;
+    char path[API_PATH_MAX];
+    ResponseHandler done;
   };
-  RelaySnapshot lastSent[4];
+  InFlight inFlight[2];          // http, commandHttp
+
+  AsyncHttpClient& clientFor(ApiEndpoint api) { return api == API_COMMANDS ? commandHttp : http; }
+  InFlight& inFlightFor(const AsyncHttpClient& client) { return &client == &commandHttp ? inFlight[1] : inFlight[0]; }
+  bool sendRequest(AsyncHttpClient& client, ApiEndpoint api, const char* method, const char* path,
+                   const JsonDocument* payload, ResponseHandler done, bool withApiKey = false);
+  void onResponse(AsyncHttpClient& client, int httpCode, const char* body, size_t length);
+  bool makePostRequest(ApiEndpoint api, const char* path, const JsonDocument& payload,
+                       ResponseHandler done = nullptr);
+  bool makeGetRequest(ApiEndpoint api, const char* path, ResponseHandler done);
+  bool makePutRequest(ApiEndpoint api, const char* path, const JsonDocument& payload,
+                      ResponseHandler done = nullptr);
 
-  bool makePostRequest(const String& endpoint, const String& jsonPayload, String& response);
-  bool makeGetRequest(const String& endpoint, String& response);
-  bool makePutRequest(const String& endpoint, const String& jsonPayload, String& response);
+  // Request payloads are built in docArena and encoded into ioBuffer, and
+  // responses are parsed from ioBuffer into docArena, so neither allocates
+  // on the heap. Handlers run one at a time and a request's document is
+  // gone once it's sent, so the two never overlap.
+  alignas(4) uint8_t docBuffer[API_DOC_ARENA];
+  ArenaAllocator docArena;
+  bool useMsgPack;                  // backend has answered in MessagePack
+  bool responseMsgPack;             // encoding of the response being handled
+  size_t encodedSize(const JsonDocument& doc) const;
+  size_t fitBatch(const JsonDocument& doc, JsonArray items) const;
+  DeserializationError parseResponse(JsonDocument& doc, const char* body, size_t length,
+                                     JsonDocument* filter = nullptr) const;
 
   void loadToken();
   void saveToken(const String& token);
@@ -0,0 +1,48 @@
+#include "ArenaAllocator.h"
+
+ArenaAllocator::ArenaAllocator(uint8_t* buffer, size_t size)
+  : buffer(buffer), size(size), top(0), peak(0), last(0), live(0) {
+}
+
+void* ArenaAllocator::allocate(size_t n) {
+  size_t length = align(n);
+  if (length + sizeof(uint32_t) > size - top) return nullptr;
+
+  last = top;
+  *(uint32_t*)(buffer + top) = length;
+  top += sizeof(uint32_t) + length;
+  if (top > peak) peak = top;
+  live++;
+  return buffer + last + sizeof(uint32_t);
+}
+
+void ArenaAllocator::deallocate(void* ptr) {
+  if (!ptr || live == 0) return;
+  // Only the top block's space can be reused right away; the rest comes
+  // back when the arena empties
+  if (isTop(ptr)) top = last;
+  if (--live == 0) top = last = 0;
+}
+
+// ArduinoJson shrinks strings and grows its pool list this way. The top
+// block is resized in place; others shrink in place or move up.
+void* ArenaAllocator::reallocate(void* ptr, size_t newSize) {
+  if (!ptr) return allocate(newSize);
+
+  size_t length = align(newSize);
+  if (isTop(ptr)) {
+    size_t start = last + sizeof(uint32_t);
+    if (length > size - start) return nullptr;
+    blockLength(ptr) = length;
+    top = start + length;
+    if (top > peak) peak = top;
+    return ptr;
+  }
+  if (length <= blockLength(ptr)) return ptr;
+
+  void* moved = allocate(newSize);
+  if (!moved) return nullptr;
+  memcpy(moved, ptr, blockLength(ptr));
+  deallocate(ptr);
+  return moved;
+}
@@ -0,0 +1,38 @@
+#ifndef ARENA_ALLOCATOR_H
+#define ARENA_ALLOCATOR_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// ArduinoJson allocator that carves blocks out of a fixed buffer instead of
+// the heap, for documents that are built, used and dropped in one go (the
+// request payloads). Blocks are stacked: freeing the top one gives its space
+// back, and the arena starts over once every block is freed. When the
+// buffer runs out allocations fail and the document reports overflowed().
+class ArenaAllocator : public ArduinoJson::Allocator {
+public:
+  ArenaAllocator(uint8_t* buffer, size_t size);
+
+  void* allocate(size_t size) override;
+  void deallocate(void* ptr) override;
+  void* reallocate(void* ptr, size_t newSize) override;
+
+  size_t used() const { return top; }
+  size_t getPeak() const { return peak; }  // most ever in use at once
+  size_t getCapacity() const { return size; }
+
+private:
+  uint8_t* buffer;
+  size_t size;
+  size_t top;     // first free byte
+  size_t peak;
+  size_t last;    // header of the topmost block
+  uint16_t live;  // blocks not freed yet
+
+  // Each block is preceded by its (aligned) length
+  static size_t align(size_t n) { return (n + 3) & ~(size_t)3; }
+  uint32_t& blockLength(void* ptr) const { return *((uint32_t*)ptr - 1); }
+  bool isTop(void* ptr) const { return live > 0 && (uint8_t*)ptr == buffer + last + sizeof(uint32_t); }
+};
+
+#endif // ARENA_ALLOCATOR_H
@@ -0,0 +1,315 @@
+#include "AsyncHttpClient.h"
+
+AsyncHttpClient::AsyncHttpClient(WiFiClient& client, HttpBuffer& rx)
+  : client(client), port(80), responseTimeout(HTTP_HEADER_TIMEOUT), phase(IDLE), phaseStart(0),
+    headLength(0), requestBody(nullptr), requestBodyLength(0), sent(0),
+    reused(false), retried(false), gotResponse(false), status(0), keepAlive(true),
+    chunked(false), contentLength(-1), chunkState(CHUNK_SIZE), chunkRemaining(0),
+    lineLength(0), rx(rx), rxLength(0), received(0), overflowed(false) {
+  contentType[0] = '\0';
+}
+
+bool AsyncHttpClient::begin(const String& baseUrl) {
+  String rest;
+  if (baseUrl.startsWith("https://")) {
+    port = 443;
+    rest = baseUrl.substring(8);
+  } else if (baseUrl.startsWith("http://")) {
+    port = 80;
+    rest = baseUrl.substring(7);
+  } else {
+    return false;
+  }
+
+  int slash = rest.indexOf('/');
+  host = slash < 0 ? rest : rest.substring(0, slash);
+  basePath = slash < 0 ? String() : rest.substring(slash);
+  if (basePath.endsWith("/")) basePath.remove(basePath.length() - 1);
+
+  int colon = host.indexOf(':');
+  if (colon >= 0) {
+    port = host.substring(colon + 1).toInt();
+    host.remove(colon);
+  }
+  return host.length() > 0 && port > 0;
+}
+
+bool AsyncHttpClient::start(const char* method, const char* path, const char* headers, const uint8_t* body,
+                            size_t bodyLength, Callback done) {
+  if (busy()) return false;
+
+  char portSuffix[8] = "";
+  if (port != 80 && port != 443) snprintf(portSuffix, sizeof(portSuffix), ":%u", port);
+  char lengthHeader[32] = "";
+  if (bodyLength > 0 || strcmp(method, "GET") != 0) {
+    snprintf(lengthHeader, sizeof(lengthHeader), "Content-Length: %u\r\n", (unsigned int)bodyLength);
+  }
+  int n = snprintf(head, sizeof(head), "%s %s%s HTTP/1.1\r\nHost: %s%s\r\nConnection: keep-alive\r\n%s%s\r\n",
+                   method, basePath.c_str(), path, host.c_str(), portSuffix, headers, lengthHeader);
+  if (n < 0 || (size_t)n >= sizeof(head)) return false;
+  headLength = n;
+  requestBody = body;
+  requestBodyLength = bodyLength;
+
+  callback = done;
+  retried = false;
+  enterPhase(CONNECTING);
+  return true;
+}
+
+void AsyncHttpClient::enterPhase(Phase p) {
+  phase = p;
+  phaseStart = millis();
+  if (p == CONNECTING) {
+    sent = 0;
+    gotResponse = false;
+  }
+}
+
+void AsyncHttpClient::poll() {
+  switch (phase) {
+    case IDLE:
+      return;
+
+    case CONNECTING:
+      reused = client.connected();
+      if (!reused) {
+        client.stop();  // drop a half-closed socket before reconnecting
+        client.setTimeout(HTTP_CONNECT_TIMEOUT);
+        if (!client.connect(host.c_str(), port)) {
+          fail(HTTPC_ERROR_CONNECTION_FAILED);
+          return;
+        }
+      }
+      enterPhase(SENDING);
+      return;
+
+    case SENDING: {
+      if (!client.connected()) {
+        fail(HTTPC_ERROR_CONNECTION_LOST);
+        return;
+      }
+      // Headers first, then the body from the caller's buffer
+      const uint8_t* from = sent < headLength ? (const uint8_t*)head + sent
+                                              : requestBody + (sent - headLength);
+      size_t n = sent < headLength ? headLength - sent : headLength + requestBodyLength - sent;
+      if (n > HTTP_IO_SLICE) n = HTTP_IO_SLICE;
+      size_t room = client.availableForWrite();
+      if (n > room) n = room;
+      if (n > 0) {
+        size_t written = client.write(from, n);
+        if (written == 0) {
+          fail(HTTPC_ERROR_SEND_PAYLOAD_FAILED);
+          return;
+        }
+        sent += written;
+      }
+      if (sent >= headLength + requestBodyLength) {
+        status = 0;
+        keepAlive = true;
+        chunked = false;
+        contentLength = -1;
+        contentType[0] = '\0';
+        lineLength = 0;
+        rxLength = 0;
+        received = 0;
+        overflowed = false;
+        enterPhase(HEADERS);
+      } else if (timedOut(HTTP_SEND_TIMEOUT)) {
+        fail(HTTPC_ERROR_SEND_PAYLOAD_FAILED);
+      }
+      return;
+    }
+
+    case HEADERS:
+      while (readLine()) {
+        if (status == 0) {
+          // Status line: "HTTP/1.1 200 OK"
+          if (strncmp(line, "HTTP/1.", 7) != 0 || lineLength < 12) {
+            fail(HTTPC_ERROR_NO_HTTP_SERVER);
+            return;
+          }
+          keepAlive = line[7] == '1';
+          status = strtol(line + 9, nullptr, 10);
+        } else if (lineLength == 0) {
+          bool noBody = status == 204 || status == 304 || (!chunked && contentLength == 0);
+          if (noBody) {
+            finish(status);
+          } else {
+            chunkState = CHUNK_SIZE;
+            enterPhase(BODY);
+          }
+          return;
+        } else {
+          parseHeader();
+        }
+        lineLength = 0;
+      }
+      if (!client.connected()) {
+        fail(HTTPC_ERROR_CONNECTION_LOST);
+      } else if (timedOut(responseTimeout)) {
+        fail(HTTPC_ERROR_READ_TIMEOUT);
+      }
+      return;
+
+    case BODY:
+      // Wait for the other connection to be done with the buffer; its
+      // response is bounded by its own timeouts, so ours only starts then
+      if (!rx.claim(this)) {
+        phaseStart = millis();
+        return;
+      }
+      if (readBody()) {
+        finish(status);
+      } else if (!client.connected()) {
+        // Without a length or chunking, the body runs until the server closes
+        if (!chunked && contentLength < 0) {
+          keepAlive = false;
+          finish(status);
+        } else {
+          fail(HTTPC_ERROR_CONNECTION_LOST);
+        }
+      } else if (timedOut(HTTP_BODY_TIMEOUT)) {
+        fail(HTTPC_ERROR_READ_TIMEOUT);
+      }
+      return;
+  }
+}
+
+void AsyncHttpClient::wait() {
+  while (busy()) {
+    poll();
+    delay(1);
+  }
+}
+
+// Append buffered bytes to `line` up to a newline. Returns true once a full
+// line (without CR/LF, NUL-terminated) is there; the caller clears it after
+// use by resetting lineLength.
+bool AsyncHttpClient::readLine() {
+  while (client.available()) {
+    int c = client.read();
+    if (c < 0) break;
+    gotResponse = true;
+    if (c == '\n') {
+      line[lineLength] = '\0';
+      return true;
+    }
+    if (c != '\r' && lineLength < sizeof(line) - 1) line[lineLength++] = c;
+  }
+  return false;
+}
+
+// Only the headers that decide how the body is framed and whether the
+// connection stays open matter here.
+void AsyncHttpClient::parseHeader() {
+  char* colon = strchr(line, ':');
+  if (!colon) return;
+  for (char* p = line; *p; p++) *p = tolower(*p);
+  *colon = '\0';
+  const char* name = line;
+  char* value = colon + 1;
+  while (*value == ' ' || *value == '\t') value++;
+  char* end = line + lineLength;
+  while (end > value && (end[-1] == ' ' || end[-1] == '\t')) *--end = '\0';
+
+  if (strcmp(name, "content-length") == 0) {
+    contentLength = strtol(value, nullptr, 10);
+  } else if (strcmp(name, "transfer-encoding") == 0) {
+    chunked = strstr(value, "chunked") != nullptr;
+  } else if (strcmp(name, "content-type") == 0) {
+    strlcpy(contentType, value, sizeof(contentType));
+  } else if (strcmp(name, "connection") == 0) {
+    if (strcmp(value, "close") == 0) keepAlive = false;
+    else if (strcmp(value, "keep-alive") == 0) keepAlive = true;
+  }
+}
+
+// Move up to HTTP_IO_SLICE bytes of body into rx, or past it once it's
+// full. Returns true when it's complete.
+bool AsyncHttpClient::readBody() {
+  uint8_t buf[128];
+  size_t budget = HTTP_IO_SLICE;
+
+  while (budget > 0 && client.available()) {
+    if (chunked && chunkState != CHUNK_DATA) {
+      if (!readLine()) return false;
+      if (chunkState == CHUNK_SIZE) {
+        chunkRemaining = strtol(line, nullptr, 16);
+        chunkState = chunkRemaining > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+      } else if (chunkState == CHUNK_DATA_END) {
+        chunkState = CHUNK_SIZE;
+      } else if (lineLength == 0) {
+        return true;  // blank line after the last chunk
+      }
+      lineLength = 0;
+      continue;
+    }
+
+    size_t want = budget < sizeof(buf) ? budget : sizeof(buf);
+    if (chunked && (long)want > chunkRemaining) want = chunkRemaining;
+    if (!chunked && contentLength >= 0 && (long)want > contentLength - received) {
+      want = contentLength - received;
+    }
+    int n = client.read(buf, want);
+    if (n <= 0) break;
+    gotResponse = true;
+    received += n;
+    budget -= n;
+    // Keep a byte for the terminating NUL
+    if (!overflowed && rxLength + n < rx.size) {
+      memcpy(rx.data + rxLength, buf, n);
+      rxLength += n;
+      rx.used(rxLength + 1);
+    } else {
+      overflowed = true;
+    }
+
+    if (chunked) {
+      chunkRemaining -= n;
+      if (chunkRemaining == 0) chunkState = CHUNK_DATA_END;
+    } else if (contentLength >= 0 && received >= contentLength) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// A reused keep-alive socket the server has since closed only shows up as a
+// failure before any response byte; that gets one retry on a new connection.
+// A timeout doesn't: the server may be processing the request.
+void AsyncHttpClient::fail(int error) {
+  bool stale = reused && !retried && !gotResponse
+            && (phase == SENDING || phase == HEADERS)
+            && error != HTTPC_ERROR_READ_TIMEOUT;
+  if (stale) {
+    client.stop();
+    retried = true;
+    enterPhase(CONNECTING);
+    return;
+  }
+  finish(error);
+}
+
+void AsyncHttpClient::finish(int result) {
+  if (result < 0 || !keepAlive) client.stop();
+  phase = IDLE;
+  headLength = 0;
+  requestBody = nullptr;
+  requestBodyLength = 0;
+
+  // The callback may start the next request
+  Callback done = callback;
+  callback = nullptr;
+  const char* body = "";
+  size_t length = 0;
+  if (rx.owner == this && result >= 0) {
+    rx.data[rxLength] = '\0';
+    body = overflowed ? nullptr : rx.data;
+    length = overflowed ? 0 : rxLength;
+  }
+  if (done) done(result, body, length);
+
+  // Kept if the callback encoded its next request into the buffer
+  if (!busy() || requestBody != (const uint8_t*)rx.data) rx.release(this);
+}
@@ -0,0 +1,131 @@
+#ifndef ASYNC_HTTP_CLIENT_H
+#define ASYNC_HTTP_CLIENT_H
+
+#include <Arduino.h>
+#include <functional>
+#include <ESP8266WiFi.h>
+#include <ESP8266HTTPClient.h>  // HTTP_CODE_* / HTTPC_ERROR_* codes only
+#include "Config.h"
+
+// Minimal HTTP/1.1 client that never holds up loop(). A request is a state
+// machine (connect, send, headers, body) that poll() advances by a bounded
+// amount of work per call, each phase with its own timeout; the callback
+// gets the status (or a negative HTTPC_ERROR_* code) and body.
+//
+// The body is collected in an HttpBuffer the caller provides, so a
+// response allocates nothing. One that doesn't fit is still read to the end
+// (the connection stays usable) and handed over as a null body with the
+// real status; the caller decides whether that's an error. Clients may
+// share one buffer: each takes it when its body starts arriving and gives
+// it back after the callback, and one that finds it taken waits (the bytes
+// stay in the socket) until it's free.
+//
+// One request at a time. The connection is kept open between requests and
+// a request that finds a reused connection dead before any response byte
+// arrives is retried once on a fresh one. Establishing the connection is
+// the one blocking step (WiFiClient::connect, plus the TLS handshake over
+// HTTPS), bounded by HTTP_CONNECT_TIMEOUT; with keep-alive and TLS session
+// resumption it is rare and short.
+// A buffer connections take turns with. `owner` is whoever holds it, or
+// nullptr while it's free.
+struct HttpBuffer {
+  char* data;
+  size_t size;
+  const void* owner;
+  size_t peak;   // most bytes held at once, kept or sent
+
+  HttpBuffer(char* data, size_t size) : data(data), size(size), owner(nullptr), peak(0) {}
+  bool claim(const void* who) {
+    if (owner && owner != who) return false;
+    owner = who;
+    return true;
+  }
+  void release(const void* who) {
+    if (owner == who) owner = nullptr;
+  }
+  void used(size_t n) {
+    if (n > peak) peak = n;
+  }
+};
+
+class AsyncHttpClient {
+public:
+  // `body` points into the receive buffer, NUL-terminated, and is only
+  // valid during the call; nullptr if the response didn't fit
+  typedef std::function<void(int status, const char* body, size_t length)> Callback;
+
+  AsyncHttpClient(WiFiClient& client, HttpBuffer& rx);
+
+  // Base URL, e.g. "https://example.com:8443/prefix". Returns false if it
+  // can't be parsed.
+  bool begin(const String& baseUrl);
+
+  // Time allowed from the request being sent to the end of the response
+  // headers; longer for requests the server holds (long polls).
+  void setResponseTimeout(unsigned long ms) { responseTimeout = ms; }
+
+  // `headers` are extra header lines, each ending in "\r\n". The request
+  // line and headers are formatted into a fixed HTTP_REQUEST_HEAD buffer;
+  // the body is sent straight from the caller's buffer, which must stay
+  // untouched until the callback runs. A body encoded into the receive
+  // buffer must be sent by the client that has claimed it; the claim then
+  // lasts until the response has been handled. Returns false if a request
+  // is already in flight or the headers don't fit.
+  bool start(const char* method, const char* path, const char* headers, const uint8_t* body,
+             size_t bodyLength, Callback done);
+  void poll();
+  void wait();  // poll until idle; setup() only
+  bool busy() const { return phase != IDLE; }
+  bool connected() const { return client.connected(); }
+  const String& getHost() const { return host; }
+  uint16_t getPort() const { return port; }
+
+  // Of the last response, lowercase; valid in the callback
+  const char* getContentType() const { return contentType; }
+
+private:
+  enum Phase : uint8_t { IDLE, CONNECTING, SENDING, HEADERS, BODY };
+  enum Chunk : uint8_t { CHUNK_SIZE, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILER };
+
+  WiFiClient& client;
+  String host;
+  uint16_t port;
+  String basePath;
+  unsigned long responseTimeout;
+
+  Phase phase;
+  unsigned long phaseStart;
+  Callback callback;
+  char head[HTTP_REQUEST_HEAD];  // request line and headers
+  size_t headLength;
+  const uint8_t* requestBody;
+  size_t requestBodyLength;
+  size_t sent;           // of both
+  bool reused;
+  bool retried;
+  bool gotResponse;     // any response byte, so a failure can't be a stale socket
+
+  int status;
+  bool keepAlive;
+  bool chunked;
+  long contentLength;   // -1 = until the server closes
+  Chunk chunkState;
+  long chunkRemaining;
+  char contentType[48];
+  char line[HTTP_MAX_LINE];  // status line, header or chunk size; longer ones are cut
+  size_t lineLength;
+  HttpBuffer& rx;         // response body, once claimed
+  size_t rxLength;       // bytes kept in rx
+  long received;         // body bytes read, kept or not
+  bool overflowed;       // body didn't fit rx
+
+  void enterPhase(Phase p);
+  bool timedOut(unsigned long limit) const { return millis() - phaseStart >= limit; }
+  bool readLine();
+  void parseHeader();
+  bool readBody();
+  void fail(int error);
+  void finish(int result);
+};
+
+#endif // ASYNC_HTTP_CLIENT_H
@@ -0,0 +1,40 @@
+#include "CircuitBreaker.h"
+
+CircuitBreaker::CircuitBreaker() : failures(0), lastFailure(0), delayMs(0) {
+}
+
+void CircuitBreaker::recordSuccess() {
+  failures = 0;
+  delayMs = 0;
+}
+
+void CircuitBreaker::recordFailure(unsigned long now) {
+  if (failures < 255) failures++;
+  lastFailure = now;
+
+  unsigned long backoff = RETRY_MAX_DELAY;
+  if (failures <= 16) {
+    backoff = RETRY_BASE_DELAY << (failures - 1);
+    if (backoff > RETRY_MAX_DELAY) backoff = RETRY_MAX_DELAY;
+  }
+  // Half fixed, half random
+  delayMs = backoff / 2 + random(backoff / 2 + 1);
+}
+
+CircuitBreaker::State CircuitBreaker::getState(unsigned long now) const {
+  if (failures < BREAKER_THRESHOLD) return CLOSED;
+  return allow(now) ? HALF_OPEN : OPEN;
+}
+
+unsigned long CircuitBreaker::getRetryIn(unsigned long now) const {
+  return allow(now) ? 0 : delayMs - (now - lastFailure);
+}
+
+const char* CircuitBreaker::stateToString(State s) {
+  switch (s) {
+    case CLOSED: return "CLOSED";
+    case OPEN: return "OPEN";
+    case HALF_OPEN: return "HALF_OPEN";
+  }
+  return "CLOSED";
+}
@@ -0,0 +1,34 @@
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include <Arduino.h>
+#include "Config.h"
+
+// Retry scheduling for one backend endpoint. Each failure in a row doubles
+// the wait before the next attempt (RETRY_BASE_DELAY up to RETRY_MAX_DELAY,
+// with jitter so devices don't retry in lockstep after an outage). From
+// BREAKER_THRESHOLD failures on the breaker is OPEN: the endpoint is left
+// alone until the wait runs out, then HALF_OPEN lets a single probe through,
+// whose failure opens it again for longer. Any success closes it.
+class CircuitBreaker {
+public:
+  enum State : uint8_t { CLOSED, OPEN, HALF_OPEN };
+
+  CircuitBreaker();
+
+  bool allow(unsigned long now) const { return failures == 0 || now - lastFailure >= delayMs; }
+  void recordSuccess();
+  void recordFailure(unsigned long now);
+
+  State getState(unsigned long now) const;
+  uint8_t getFailures() const { return failures; }
+  unsigned long getRetryIn(unsigned long now) const;  // ms, 0 = may send now
+  static const char* stateToString(State s);
+
+private:
+  uint8_t failures;          // in a row
+  unsigned long lastFailure;
+  unsigned long delayMs;     // wait after lastFailure, jitter included
+};
+
+#endif // CIRCUIT_BREAKER_H
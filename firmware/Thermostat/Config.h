@@ -5,7 +5,12 @@
 
 // ---- Pin Definitions ----
 #define ONE_WIRE_BUS D2
-static const int RELAY_PINS[4] = { D1, D5, D6, D7 };
+// Relay outputs (active-LOW). The relay count everywhere — controller state,
+// sync flags, saved config, /status and the web UI rows — follows this
+// table; edit it for other boards.
+constexpr uint8_t RELAY_PINS[] = { D1, D5, D6, D7 };
+constexpr uint8_t RELAY_COUNT = sizeof(RELAY_PINS) / sizeof(RELAY_PINS[0]);
+static_assert(RELAY_COUNT >= 1 && RELAY_COUNT <= 8, "relay change masks are 8 bits wide");
 
 // ---- System Configuration ----
 constexpr int DEFAULT_UPDATE_FREQUENCY = 5; // seconds
@@ -15,33 +20,124 @@ constexpr size_t MAX_SYSTEM_LOGS = 500;
 // API_URL is defined in Credentials.h
 #define FIRMWARE_VERSION "2.1.0"
 constexpr int API_HEARTBEAT_INTERVAL = 60000;  // ms (1 minute)
-constexpr int API_COMMAND_POLL_INTERVAL = 30000;  // ms (30 seconds)
-constexpr int HTTP_REQUEST_TIMEOUT = 5000;     // ms — kept short so blocking calls don't starve the web server
+// Commands are long-polled on their own connection: the backend holds the
+// request until a command arrives or API_COMMAND_WAIT runs out, and the next
+// poll starts as soon as it returns.
+constexpr int API_COMMAND_WAIT = 25;               // seconds, held by the backend (max 25)
+constexpr unsigned long API_COMMAND_REPOLL_DELAY = 1000;  // ms — min gap between polls
+constexpr unsigned long RESTART_GRACE_PERIOD = 10000;  // ms — max wait for command statuses to go out before a restart
+// Per-phase limits for the non-blocking backend client (AsyncHttpClient)
+constexpr unsigned long HTTP_CONNECT_TIMEOUT = 5000;  // ms — TCP connect (+ TLS handshake); the one blocking step
+constexpr unsigned long HTTP_SEND_TIMEOUT = 5000;     // ms — writing the request
+constexpr unsigned long HTTP_HEADER_TIMEOUT = 5000;   // ms — from request sent to end of response headers
+constexpr unsigned long HTTP_BODY_TIMEOUT = 5000;     // ms — reading the response body
+constexpr size_t HTTP_IO_SLICE = 512;                 // bytes moved per loop() pass
+constexpr size_t HTTP_REQUEST_HEAD = 512;             // bytes — request line + headers, per connection
+constexpr size_t HTTP_MAX_LINE = 256;                 // bytes — response status / header line kept
+// Sized for the largest backend response this device uses: a set_schedule
+// for every relay (RELAY_COUNT x SCHEDULE_MAX_ENTRIES, 3.9 KB as JSON for 4
+// relays) plus nine small commands (~95 B each); a 64-reading batch is
+// ~4 KB as JSON. The heap log shows the peaks actually reached.
+constexpr size_t API_IO_BUFFER = 5120;                // bytes — request payload and response body, shared by both connections
+constexpr size_t API_DOC_ARENA = 6144;                // bytes — request and parsed response JsonDocuments live here, not on the heap
+constexpr size_t API_PATH_MAX = 64;                   // bytes — request path, e.g. /api/devices/12/commands/345
+constexpr size_t API_STATUS_RESULT_MAX = 96;          // bytes — result message of a queued command status update
+// Per-endpoint retry backoff and circuit breaker (see CircuitBreaker.h)
+constexpr unsigned long RETRY_BASE_DELAY = 2000;      // ms — wait after the first failure
+constexpr unsigned long RETRY_MAX_DELAY = 300000;     // ms (5 minutes)
+constexpr uint8_t BREAKER_THRESHOLD = 5;              // failures in a row that open the breaker
 constexpr int TLS_RX_BUFFER = 1024;            // bytes — TLS fragment input buffer
 constexpr int TLS_TX_BUFFER = 4096;            // bytes — TLS output buffer (handshake needs >2K)
+// The command poll's second TLS context is kept small where the server
+// agrees to a reduced max fragment length, and only held while the heap
+// can spare it; without it commands come with sync responses.
+constexpr int TLS_COMMAND_BUFFER = 512;              // bytes — command connection's TLS buffers, each way, with MFLN
+constexpr uint32_t API_COMMAND_OPEN_HEAP = 16384;    // bytes free needed to open the command connection
+constexpr uint32_t API_COMMAND_KEEP_HEAP = 8192;     // bytes free below which an open one is closed
+
+// Telemetry is queued in a LittleFS outbox with device timestamps and
+// uploaded in batches; it survives outages and reboots up to its capacity,
+// then the oldest entries are overwritten.
+#define OUTBOX_READINGS_FILE "/outbox_temp.dat"
+#define OUTBOX_RELAY_FILE "/outbox_relay.dat"
+constexpr uint32_t OUTBOX_READINGS_CAPACITY = 8192;  // records (8 B each, 64 KB) — ~11 h at 5 s for one sensor
+constexpr uint32_t OUTBOX_RELAY_CAPACITY = 1024;     // records (32 B each, 32 KB)
+constexpr uint8_t TELEMETRY_BATCH_READINGS = 16;     // upload early once this many readings are queued
+constexpr uint8_t OUTBOX_READINGS_BATCH = 64;        // readings per upload (backend accepts 100)
+constexpr uint8_t OUTBOX_RELAY_BATCH = 16;           // relay states per upload
+constexpr unsigned long TELEMETRY_FLUSH_INTERVAL = 30000; // ms — max age of the oldest queued reading
+constexpr unsigned long RELAY_FLUSH_DELAY = 1000;    // ms — lets a burst of relay changes share one upload
+constexpr unsigned long OUTBOX_DRAIN_INTERVAL = 2000; // ms between uploads while working off a backlog
+constexpr unsigned long OUTBOX_STAGE_INTERVAL = 60000; // ms — readings not yet uploaded reach flash within this; relay states go at once
 constexpr unsigned long WIFI_RECONNECT_INTERVAL = 30000; // ms between reconnect attempts
 constexpr unsigned long HEAP_LOG_INTERVAL = 300000;      // ms (5 min) periodic heap snapshot
 
 // ---- File Paths ----
 #define CONFIG_FILE "/config.json"
-#define LOG_FILE "/temp_log.csv"
+#define LOG_FILE "/temp_log.dat"
+#define LEGACY_LOG_FILE "/temp_log.csv"   // pre-2.2 text log, removed on boot
+constexpr uint32_t TEMP_LOG_CAPACITY = 20480;  // records (8 B each, 160 KB) — ~28 h at 5 s for one sensor
+constexpr size_t TEMP_LOG_STAGING_BYTES = 512;        // RAM staging per store (two 256 B flash pages)
+constexpr unsigned long TEMP_LOG_FLUSH_INTERVAL = 300000; // ms — flush staged records at least every 5 min
+
+// Rollup tiers (min/avg/max per bucket, 16 B records), sized for MAX_TEMP_SENSORS
+#define ROLLUP_1M_FILE "/temp_1m.dat"
+#define ROLLUP_15M_FILE "/temp_15m.dat"
+#define ROLLUP_1H_FILE "/temp_1h.dat"
+constexpr uint32_t ROLLUP_1M_CAPACITY = 5760;   // 24 h x 4 sensors (92 KB)
+constexpr uint32_t ROLLUP_15M_CAPACITY = 2880;  // 7.5 d x 4 sensors (46 KB)
+constexpr uint32_t ROLLUP_1H_CAPACITY = 2880;   // 30 d x 4 sensors (46 KB)
+
+// ---- Weekly Schedule ----
+#define SCHEDULE_FILE "/schedule.dat"
+#define TIMEZONE "UTC0"   // POSIX TZ the schedule's times are in, e.g. "CET-1CEST,M3.5.0,M10.5.0/3"
+constexpr uint8_t SCHEDULE_MAX_ENTRIES = 16;      // per relay, each with a day mask
+constexpr uint8_t SCHEDULE_MAX_TRANSITIONS = 64;  // per relay per week once day masks are expanded
 
 // ---- OTA Configuration ----
 #define OTA_HOSTNAME "thermostat"
 
 // ---- Temperature Sensor Configuration ----
-constexpr int TEMP_NUM_SAMPLES = 3;
-constexpr float TEMP_MAX_DIFF = 2.0;        // Max difference between samples in °C
+constexpr uint8_t MAX_TEMP_SENSORS = 4;     // DS18B20s discovered on the bus at boot; sensor 0 drives the relays
+constexpr unsigned long TEMP_REDISCOVER_INTERVAL = 60000; // ms — bus re-search while no probe has been found
 constexpr float TEMP_MIN_VALID = -50.0;     // DS18B20 can read -55°C but let's be safe
 constexpr float TEMP_MAX_VALID = 85.0;      // DS18B20 max is 125°C but 85°C is realistic
-constexpr int TEMP_SAMPLE_DELAY = 100;      // ms between samples
-constexpr int TEMP_RETRY_DELAY = 200;       // ms before retry
+constexpr uint8_t TEMP_FILTER_WINDOW = 5;   // recent samples per sensor for the median/MAD gate
+constexpr float TEMP_MAD_K = 3.0;           // reject samples further than K x 1.4826 x MAD from the median
+constexpr float TEMP_OUTLIER_FLOOR = 1.0;   // °C — gate never tighter than this (MAD is 0 on a flat signal)
+constexpr float TEMP_EMA_ALPHA = 0.5;       // weight of a new accepted sample in the smoothed value (1 = no smoothing)
+
+// ---- Short-cycle protection (per-relay defaults) ----
+constexpr uint16_t RELAY_DEFAULT_MIN_ON = 60;     // seconds
+constexpr uint16_t RELAY_DEFAULT_MIN_OFF = 180;   // seconds
+constexpr uint8_t RELAY_DEFAULT_MAX_CYCLES = 6;   // starts per hour, 0 = unlimited
+constexpr uint8_t RELAY_CYCLE_HISTORY = 12;       // highest allowed max-cycles setting
+constexpr uint8_t RELAY_MAX_LISTENERS = 4;        // change-event subscribers (API, config, log)
+
+// ---- PID (time-proportioning) ----
+// Output is a 0..1 duty cycle; error is in °C, the I and D terms use minutes.
+constexpr float PID_DEFAULT_KP = 0.5;          // duty per °C of error
+constexpr float PID_DEFAULT_KI = 0.02;         // duty per °C·min of accumulated error
+constexpr float PID_DEFAULT_KD = 0.0;          // duty per °C/min of change
+constexpr uint16_t PID_DEFAULT_WINDOW = 600;   // seconds per time-proportioning window
+constexpr uint16_t PID_MIN_WINDOW = 30;
+constexpr uint16_t PID_MAX_WINDOW = 3600;
+constexpr float PID_MIN_DUTY = 0.02;           // duties below this (or above 1 - this) snap to 0 (or 1)
+
+// ---- Adaptive Sampling ----
+// The user's update frequency is the slowest cadence; we speed up toward
+// TEMP_ADAPTIVE_MIN_INTERVAL near an AUTO relay's threshold or while the
+// temperature is moving fast.
+constexpr unsigned long TEMP_ADAPTIVE_MIN_INTERVAL = 2000; // ms — well under the 5 s default, above a 750 ms 12-bit conversion
+constexpr float TEMP_ADAPTIVE_MARGIN = 0.5;        // °C from a threshold that counts as "near"
+constexpr float TEMP_ADAPTIVE_FAST_RATE = 0.5;     // °C/min that counts as "changing fast"
+constexpr unsigned long TEMP_RESOLUTION_HOLD = 1800000; // ms (30 min) before lowering resolution again — each change is a DS18B20 EEPROM write
 
 // ---- Web Server Configuration ----
 constexpr int WEB_SERVER_PORT = 80;
 constexpr int MAX_DATA_LINES = 500;         // Maximum lines to send in data endpoint
 constexpr int MIN_DATA_LINES = 100;         // Minimum lines to send
-constexpr int BYTES_PER_LINE_ESTIMATE = 20; // For file seeking calculation
+constexpr uint32_t MAX_QUERY_POINTS = 1500; // /data?from=&to= raises step so points x sensors stays under this
 
 // ---- WiFi Connection ----
 constexpr int WIFI_MAX_ATTEMPTS = 40;
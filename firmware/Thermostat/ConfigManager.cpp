@@ -1,7 +1,7 @@
 #include "ConfigManager.h"
 
-ConfigManager::ConfigManager(RelayController& relayCtrl)
-  : relayController(relayCtrl) {
+ConfigManager::ConfigManager(Relays& relayCtrl)
+  : relayController(relayCtrl), dirty(false), configVersion(0) {
 }
 
 void ConfigManager::begin() {
@@ -10,31 +10,63 @@ void ConfigManager::begin() {
   }
 }
 
+void ConfigManager::onRelayEvent(const RelayEvent& e) {
+  if ((e.changes & RELAY_CHANGED_SETTINGS) && !(e.changes & RELAY_CHANGED_TRANSIENT)) dirty = true;
+}
+
+void ConfigManager::saveIfDirty(int updateFrequency, bool useFahrenheit) {
+  if (dirty) saveSettings(updateFrequency, useFahrenheit);
+}
+
 void ConfigManager::saveSettings(int updateFrequency, bool useFahrenheit) {
+  dirty = false;
   StaticJsonDocument<1024> doc;
 
   JsonArray modes = doc.createNestedArray("modes");
-  for (int i = 0; i < 4; i++) {
+  for (int i = 0; i < RELAY_COUNT; i++) {
     modes.add((int)relayController.getRelayMode(i));
   }
 
   JsonArray types = doc.createNestedArray("types");
-  for (int i = 0; i < 4; i++) {
+  for (int i = 0; i < RELAY_COUNT; i++) {
     types.add((int)relayController.getRelayType(i));
   }
 
   JsonArray onArr = doc.createNestedArray("tempOn");
-  for (int i = 0; i < 4; i++) {
-    onArr.add(relayController.getTempOn(i));
+  for (int i = 0; i < RELAY_COUNT; i++) {
+    onArr.add(relayController.getBaseTempOn(i));
   }
 
   JsonArray offArr = doc.createNestedArray("tempOff");
-  for (int i = 0; i < 4; i++) {
-    offArr.add(relayController.getTempOff(i));
+  for (int i = 0; i < RELAY_COUNT; i++) {
+    offArr.add(relayController.getBaseTempOff(i));
+  }
+
+  JsonArray kpArr = doc.createNestedArray("pidKp");
+  JsonArray kiArr = doc.createNestedArray("pidKi");
+  JsonArray kdArr = doc.createNestedArray("pidKd");
+  JsonArray winArr = doc.createNestedArray("pidWindow");
+  for (int i = 0; i < RELAY_COUNT; i++) {
+    const PidSettings& pid = relayController.getPidSettings(i);
+    kpArr.add(pid.kp);
+    kiArr.add(pid.ki);
+    kdArr.add(pid.kd);
+    winArr.add(pid.windowSec);
+  }
+
+  JsonArray minOnArr = doc.createNestedArray("minOn");
+  JsonArray minOffArr = doc.createNestedArray("minOff");
+  JsonArray cyclesArr = doc.createNestedArray("maxCycles");
+  for (int i = 0; i < RELAY_COUNT; i++) {
+    const CycleLimits& l = relayController.getCycleLimits(i);
+    minOnArr.add(l.minOnSec);
+    minOffArr.add(l.minOffSec);
+    cyclesArr.add(l.maxCyclesPerHour);
   }
 
   doc["updateFrequency"] = updateFrequency;
   doc["useFahrenheit"] = useFahrenheit;
+  doc["configVersion"] = configVersion;
 
   File f = LittleFS.open(CONFIG_FILE, "w");
   if (!f) {
@@ -72,7 +104,7 @@ void ConfigManager::loadSettings(int& updateFrequency, bool& useFahrenheit) {
     JsonArray modes = doc["modes"];
     int i = 0;
     for (int m : modes) {
-      if (i < 4) {
+      if (i < RELAY_COUNT) {
         relayController.setRelayMode(i, (Mode)m);
         i++;
       }
@@ -84,7 +116,7 @@ void ConfigManager::loadSettings(int& updateFrequency, bool& useFahrenheit) {
     JsonArray types = doc["types"];
     int i = 0;
     for (int t : types) {
-      if (i < 4) {
+      if (i < RELAY_COUNT) {
         relayController.setRelayType(i, (RelayType)t);
         i++;
       }
@@ -95,13 +127,13 @@ void ConfigManager::loadSettings(int& updateFrequency, bool& useFahrenheit) {
   if (doc.containsKey("tempOn")) {
     JsonArray a = doc["tempOn"];
     int i = 0;
-    float tempOnValues[4];
+    float tempOnValues[RELAY_COUNT];
     for (float v : a) {
-      if (i < 4) tempOnValues[i++] = v;
+      if (i < RELAY_COUNT) tempOnValues[i++] = v;
     }
     // Update thresholds
     for (int j = 0; j < i; j++) {
-      relayController.setTempThresholds(j, tempOnValues[j], relayController.getTempOff(j));
+      relayController.setTempThresholds(j, tempOnValues[j], relayController.getBaseTempOff(j));
     }
   }
 
@@ -109,16 +141,35 @@ void ConfigManager::loadSettings(int& updateFrequency, bool& useFahrenheit) {
   if (doc.containsKey("tempOff")) {
     JsonArray a = doc["tempOff"];
     int i = 0;
-    float tempOffValues[4];
+    float tempOffValues[RELAY_COUNT];
     for (float v : a) {
-      if (i < 4) tempOffValues[i++] = v;
+      if (i < RELAY_COUNT) tempOffValues[i++] = v;
     }
     // Update thresholds
     for (int j = 0; j < i; j++) {
-      relayController.setTempThresholds(j, relayController.getTempOn(j), tempOffValues[j]);
+      relayController.setTempThresholds(j, relayController.getBaseTempOn(j), tempOffValues[j]);
     }
   }
 
+  // Load PID gains and windows; a missing key keeps the defaults
+  for (int i = 0; i < RELAY_COUNT; i++) {
+    PidSettings pid = relayController.getPidSettings(i);
+    if (doc["pidKp"][i].is<float>()) pid.kp = doc["pidKp"][i];
+    if (doc["pidKi"][i].is<float>()) pid.ki = doc["pidKi"][i];
+    if (doc["pidKd"][i].is<float>()) pid.kd = doc["pidKd"][i];
+    if (doc["pidWindow"][i].is<int>()) pid.windowSec = doc["pidWindow"][i];
+    relayController.setPidSettings(i, pid);
+  }
+
+  // Load short-cycle limits; a missing key keeps the defaults
+  for (int i = 0; i < RELAY_COUNT; i++) {
+    CycleLimits l = relayController.getCycleLimits(i);
+    if (doc["minOn"][i].is<int>()) l.minOnSec = doc["minOn"][i];
+    if (doc["minOff"][i].is<int>()) l.minOffSec = doc["minOff"][i];
+    if (doc["maxCycles"][i].is<int>()) l.maxCyclesPerHour = doc["maxCycles"][i];
+    relayController.setCycleLimits(i, l);
+  }
+
   // Load update frequency
   if (doc.containsKey("updateFrequency")) {
     updateFrequency = doc["updateFrequency"];
@@ -128,4 +179,6 @@ void ConfigManager::loadSettings(int& updateFrequency, bool& useFahrenheit) {
   if (doc.containsKey("useFahrenheit")) {
     useFahrenheit = doc["useFahrenheit"];
   }
+
+  configVersion = doc["configVersion"] | 0;
 }
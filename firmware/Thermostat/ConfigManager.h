@@ -10,14 +10,25 @@
 
 class ConfigManager {
 public:
-  ConfigManager(RelayController& relayCtrl);
+  ConfigManager(Relays& relayCtrl);
 
   void begin();
   void saveSettings(int updateFrequency, bool useFahrenheit);
   void loadSettings(int& updateFrequency, bool& useFahrenheit);
 
+  // Relay setting changes only mark the config dirty; the loop writes it
+  // once with saveIfDirty(), so several changes in one pass cost one write.
+  void onRelayEvent(const RelayEvent& e);
+  void saveIfDirty(int updateFrequency, bool useFahrenheit);
+
+  // Backend config version the saved settings correspond to; saved with them
+  uint32_t getConfigVersion() const { return configVersion; }
+  void setConfigVersion(uint32_t version) { configVersion = version; }
+
 private:
-  RelayController& relayController;
+  Relays& relayController;
+  bool dirty;
+  uint32_t configVersion;
 };
 
 #endif // CONFIG_MANAGER_H
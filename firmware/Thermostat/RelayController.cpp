@@ -1,40 +1,69 @@
 #include "RelayController.h"
 
-RelayController::RelayController() {
+// Outputs go through GPOS/GPOC for GPIO0-15; GPIO16 lives in the RTC block
+// and is written through GP16O instead (bit 16 of the masks).
+static constexpr bool pinsAreGpio(const uint8_t* p, uint8_t n) {
+  return n == 0 || (p[0] <= 16 && pinsAreGpio(p + 1, n - 1));
+}
+static_assert(pinsAreGpio(RELAY_PINS, RELAY_COUNT), "RELAY_PINS must be GPIO0-16");
+
+template <uint8_t N>
+RelayController<N>::RelayController(const uint8_t (&pinTable)[N])
+  : pins(pinTable), pinMask(0), drivenOffMask(0), listenerCount(0) {
   // Initialize default values
-  for (int i = 0; i < 4; i++) {
+  for (int i = 0; i < N; i++) {
+    pinMask |= 1UL << pins[i];
     relayStates[i] = false;
     relayModes[i] = MANUAL_OFF;
     relayTypes[i] = HEATING;  // Default to heating for floor heat
-    tempOn[i] = DEFAULT_TEMP_ON;
-    tempOff[i] = DEFAULT_TEMP_OFF;
+    tempOn[i] = baseTempOn[i] = DEFAULT_TEMP_ON;
+    tempOff[i] = baseTempOff[i] = DEFAULT_TEMP_OFF;
+    pid[i] = {PID_DEFAULT_KP, PID_DEFAULT_KI, PID_DEFAULT_KD, PID_DEFAULT_WINDOW};
+    resetPid(i);
+    limits[i] = {RELAY_DEFAULT_MIN_ON, RELAY_DEFAULT_MIN_OFF, RELAY_DEFAULT_MAX_CYCLES};
+    lastChangeMs[i] = 0;
+    memset(cycleStarts[i], 0, sizeof(cycleStarts[i]));
+    cycleHead[i] = 0;
+    pending[i] = false;
+    pendingState[i] = false;
+    versions[i] = 0;
   }
 }
 
-void RelayController::begin() {
-  // Initialize all relay pins to OFF
-  for (int i = 0; i < 4; i++) {
-    pinMode(RELAY_PINS[i], OUTPUT);
-    digitalWrite(RELAY_PINS[i], HIGH);  // Active-LOW: HIGH = OFF
+template <uint8_t N>
+void RelayController<N>::begin() {
+  // Latch HIGH before enabling the drivers so no relay blips ON at boot
+  // Active-LOW: HIGH = OFF
+  if (pinMask & 0xFFFF) GPOS = pinMask & 0xFFFF;
+  if (pinMask & GPIO16_BIT) GP16O = 1;
+  drivenOffMask = pinMask;
+  for (int i = 0; i < N; i++) {
+    pinMode(pins[i], OUTPUT);
+    // Count boot as an OFF transition so min-off also covers a power blip
+    lastChangeMs[i] = millis();
   }
-  logger.addLog("All 4 relays initialized OFF");
+  logger.addLog("All " + String(N) + " relays initialized OFF");
 }
 
-void RelayController::applyRelayLogic(float currentTemp) {
-  for (int i = 0; i < 4; i++) {
-    bool prevState = relayStates[i];
+template <uint8_t N>
+void RelayController<N>::applyRelayLogic(float currentTemp) {
+  unsigned long now = millis();
+  for (int i = 0; i < N; i++) {
+    // What the control logic wants. A deferred transition counts as already
+    // requested so hysteresis doesn't flip-flop around it.
+    bool want = pending[i] ? pendingState[i] : relayStates[i];
 
     switch (relayModes[i]) {
       case MANUAL_ON:
-        relayStates[i] = true;
+        want = true;
         break;
       case MANUAL_OFF:
-        relayStates[i] = false;
+        want = false;
         break;
-      case AUTO:
+      case AUTO: {
         // For MANUAL_ONLY type, AUTO behaves like MANUAL_OFF
         if (relayTypes[i] == MANUAL_ONLY) {
-          relayStates[i] = false;
+          want = false;
           break;
         }
 
@@ -44,83 +73,362 @@ void RelayController::applyRelayLogic(float currentTemp) {
 
         if (relayTypes[i] == HEATING) {
           // Heating: ON when cold, OFF when warm
-          if (currentTemp < tempOn[i] - epsilon) relayStates[i] = true;
-          else if (currentTemp > tempOff[i] + epsilon) relayStates[i] = false;
+          if (currentTemp < tempOn[i] - epsilon) want = true;
+          else if (currentTemp > tempOff[i] + epsilon) want = false;
         } else {
           // Cooling/Generic: ON when hot, OFF when cold
-          if (currentTemp > tempOn[i] + epsilon) relayStates[i] = true;
-          else if (currentTemp < tempOff[i] - epsilon) relayStates[i] = false;
+          if (currentTemp > tempOn[i] + epsilon) want = true;
+          else if (currentTemp < tempOff[i] - epsilon) want = false;
         }
         // Else maintain current state (hysteresis)
         break;
+      }
+      case PID:
+        if (relayTypes[i] == MANUAL_ONLY) {
+          want = false;
+          break;
+        }
+        pidOutput[i] = computePid(i, currentTemp);
+        want = timeProportionedState(i, now);
+        break;
     }
 
-    digitalWrite(RELAY_PINS[i], relayStates[i] ? LOW : HIGH); // Active-LOW
+    requestState(i, want, now);
+  }
+  writeOutputs();
+}
+
+template <uint8_t N>
+void RelayController<N>::update() {
+  unsigned long now = millis();
+  for (int i = 0; i < N; i++) {
+    bool isPid = relayModes[i] == PID && relayTypes[i] != MANUAL_ONLY && pidLastMs[i] != 0;
+    if (!isPid && !pending[i]) continue;
+
+    bool want = isPid ? timeProportionedState(i, now) : pendingState[i];
+    requestState(i, want, now);
+  }
+  writeOutputs();
+}
+
+// Switch now if the cycle limits allow it, otherwise park the request as
+// pending. Returns true only when the relay actually changed.
+template <uint8_t N>
+bool RelayController<N>::requestState(int i, bool want, unsigned long now) {
+  if (want == relayStates[i]) {
+    if (pending[i]) {
+      logger.addLog("Relay " + String(i+1) + " deferred change cancelled");
+      pending[i] = false;
+      notify(i, RELAY_CHANGED_DEFERRED);
+    }
+    return false;
+  }
+
+  unsigned long wait = blockedForMs(i, want, now);
+  if (wait > 0) {
+    if (!pending[i] || pendingState[i] != want) {
+      logger.addLog("Relay " + String(i+1) + " -> " + String(want ? "ON" : "OFF") +
+                    " deferred " + String((wait + 999) / 1000) + "s (short-cycle protection)");
+      pending[i] = true;
+      pendingState[i] = want;
+      notify(i, RELAY_CHANGED_DEFERRED);
+    }
+    return false;
+  }
+
+  uint8_t changes = RELAY_CHANGED_STATE | (pending[i] ? RELAY_CHANGED_DEFERRED : 0);
+  pending[i] = false;
+  relayStates[i] = want;
+  lastChangeMs[i] = now;
+  if (want) {
+    cycleStarts[i][cycleHead[i]] = now ? now : 1;
+    cycleHead[i] = (cycleHead[i] + 1) % RELAY_CYCLE_HISTORY;
+  }
+  notify(i, changes);
+  return true;
+}
+
+// Drive every relay from relayStates in one go, touching only the bits that
+// differ from what was last written. Nothing changed means no register write.
+template <uint8_t N>
+void RelayController<N>::writeOutputs() {
+  uint32_t offMask = 0;
+  for (int i = 0; i < N; i++) {
+    if (!relayStates[i]) offMask |= 1UL << pins[i];
+  }
+  uint32_t changed = offMask ^ drivenOffMask;
+  if (!changed) return;
+
+  // Active-LOW: OFF sets the pin, ON clears it
+  uint16_t toSet = changed & offMask & 0xFFFF;
+  uint16_t toClear = changed & ~offMask & 0xFFFF;
+  if (toSet) GPOS = toSet;
+  if (toClear) GPOC = toClear;
+  if (changed & GPIO16_BIT) GP16O = (offMask & GPIO16_BIT) ? 1 : 0;
+  drivenOffMask = offMask;
+}
+
+// How long (ms) relay i must still wait before it may switch to `want`:
+// min-on before turning off; min-off and the starts-per-hour budget before
+// turning on.
+template <uint8_t N>
+unsigned long RelayController<N>::blockedForMs(int i, bool want, unsigned long now) const {
+  unsigned long since = now - lastChangeMs[i];
+  unsigned long wait = 0;
+
+  if (!want) {
+    unsigned long minOn = (unsigned long)limits[i].minOnSec * 1000;
+    if (since < minOn) wait = minOn - since;
+    return wait;
+  }
+
+  unsigned long minOff = (unsigned long)limits[i].minOffSec * 1000;
+  if (since < minOff) wait = minOff - since;
 
-    if (prevState != relayStates[i]) {
-      logger.addLog("Relay " + String(i+1) + " -> " + String(relayStates[i] ? "ON" : "OFF") +
-                    " @ " + String(currentTemp, 1) + "C");
+  if (limits[i].maxCyclesPerHour > 0) {
+    uint8_t starts = 0;
+    unsigned long oldestAge = 0;
+    for (uint8_t k = 0; k < RELAY_CYCLE_HISTORY; k++) {
+      if (cycleStarts[i][k] == 0) continue;
+      unsigned long age = now - cycleStarts[i][k];
+      if (age >= 3600000UL) continue;
+      starts++;
+      if (age > oldestAge) oldestAge = age;
+    }
+    if (starts >= limits[i].maxCyclesPerHour && 3600000UL - oldestAge > wait) {
+      wait = 3600000UL - oldestAge;
     }
   }
+  return wait;
+}
+
+// PID on the midpoint of tempOn/tempOff. Error is signed so that positive
+// always means "more output": below setpoint for HEATING, above it otherwise.
+template <uint8_t N>
+float RelayController<N>::computePid(int i, float currentTemp) {
+  float setpoint = (tempOn[i] + tempOff[i]) / 2.0f;
+  bool heating = relayTypes[i] == HEATING;
+  float error = heating ? setpoint - currentTemp : currentTemp - setpoint;
+
+  unsigned long now = millis();
+  float dtMin = pidLastMs[i] ? (now - pidLastMs[i]) / 60000.0f : 0.0f;
+
+  float p = pid[i].kp * error;
+  float d = 0.0f;
+  if (dtMin > 0.0f) {
+    // Derivative on measurement so a setpoint change doesn't kick the output
+    float slope = (currentTemp - pidLastTemp[i]) / dtMin;
+    d = -pid[i].kd * (heating ? slope : -slope);
+  }
+
+  // Anti-windup: don't integrate further into saturation, and keep the
+  // I term itself inside the output range.
+  float unclamped = p + pidIntegral[i] + d;
+  bool saturated = (unclamped >= 1.0f && error > 0) || (unclamped <= 0.0f && error < 0);
+  if (dtMin > 0.0f && !saturated) {
+    pidIntegral[i] = constrain(pidIntegral[i] + pid[i].ki * error * dtMin, 0.0f, 1.0f);
+  }
+
+  pidLastTemp[i] = currentTemp;
+  pidLastMs[i] = now ? now : 1;
+  return constrain(p + pidIntegral[i] + d, 0.0f, 1.0f);
+}
+
+// The duty is latched once per window so a relay switches at most twice per
+// window however often the PID output moves.
+template <uint8_t N>
+bool RelayController<N>::timeProportionedState(int i, unsigned long now) {
+  unsigned long windowMs = (unsigned long)pid[i].windowSec * 1000;
+  if (windowStart[i] == 0 || now - windowStart[i] >= windowMs) {
+    windowStart[i] = now ? now : 1;
+    float duty = pidOutput[i];
+    if (duty < PID_MIN_DUTY) duty = 0.0f;
+    else if (duty > 1.0f - PID_MIN_DUTY) duty = 1.0f;
+    windowDuty[i] = duty;
+  }
+  return now - windowStart[i] < (unsigned long)(windowDuty[i] * windowMs);
+}
+
+template <uint8_t N>
+void RelayController<N>::resetPid(int i) {
+  pidIntegral[i] = 0.0f;
+  pidLastTemp[i] = 0.0f;
+  pidLastMs[i] = 0;
+  pidOutput[i] = 0.0f;
+  windowDuty[i] = 0.0f;
+  windowStart[i] = 0;
 }
 
 // Getters
-bool RelayController::getRelayState(int index) const {
-  if (index >= 0 && index < 4) return relayStates[index];
-  return false;
+template <uint8_t N>
+bool RelayController<N>::getRelayState(int index) const {
+  return relayStates[index];
 }
 
-Mode RelayController::getRelayMode(int index) const {
-  if (index >= 0 && index < 4) return relayModes[index];
-  return MANUAL_OFF;
+template <uint8_t N>
+Mode RelayController<N>::getRelayMode(int index) const {
+  return relayModes[index];
 }
 
-RelayType RelayController::getRelayType(int index) const {
-  if (index >= 0 && index < 4) return relayTypes[index];
-  return HEATING;
+template <uint8_t N>
+RelayType RelayController<N>::getRelayType(int index) const {
+  return relayTypes[index];
 }
 
-float RelayController::getTempOn(int index) const {
-  if (index >= 0 && index < 4) return tempOn[index];
-  return DEFAULT_TEMP_ON;
+template <uint8_t N>
+float RelayController<N>::getTempOn(int index) const {
+  return tempOn[index];
 }
 
-float RelayController::getTempOff(int index) const {
-  if (index >= 0 && index < 4) return tempOff[index];
-  return DEFAULT_TEMP_OFF;
+template <uint8_t N>
+float RelayController<N>::getTempOff(int index) const {
+  return tempOff[index];
 }
 
-// Setters
-void RelayController::setRelayMode(int index, Mode mode) {
-  if (index >= 0 && index < 4) {
-    relayModes[index] = mode;
-  }
+template <uint8_t N>
+float RelayController<N>::getBaseTempOn(int index) const {
+  return baseTempOn[index];
+}
+
+template <uint8_t N>
+float RelayController<N>::getBaseTempOff(int index) const {
+  return baseTempOff[index];
+}
+
+template <uint8_t N>
+const CycleLimits& RelayController<N>::getCycleLimits(int index) const {
+  return limits[index];
+}
+
+template <uint8_t N>
+bool RelayController<N>::isDeferred(int index) const {
+  return pending[index];
+}
+
+template <uint8_t N>
+bool RelayController<N>::getDeferredState(int index) const {
+  return pendingState[index];
+}
+
+template <uint8_t N>
+unsigned long RelayController<N>::getDeferredRemaining(int index) const {
+  if (!pending[index]) return 0;
+  return (blockedForMs(index, pendingState[index], millis()) + 999) / 1000;
+}
+
+template <uint8_t N>
+const PidSettings& RelayController<N>::getPidSettings(int index) const {
+  return pid[index];
 }
 
-void RelayController::setRelayType(int index, RelayType type) {
-  if (index >= 0 && index < 4) {
-    relayTypes[index] = type;
+template <uint8_t N>
+float RelayController<N>::getPidOutput(int index) const {
+  return pidOutput[index];
+}
+
+template <uint8_t N>
+uint32_t RelayController<N>::getVersion(int index) const {
+  return versions[index];
+}
+
+template <uint8_t N>
+float RelayController<N>::getThresholdDistance(float temp) const {
+  float nearest = 1e6;
+  for (int i = 0; i < N; i++) {
+    if ((relayModes[i] != AUTO && relayModes[i] != PID) || relayTypes[i] == MANUAL_ONLY) continue;
+    float dOn = fabs(temp - tempOn[i]);
+    float dOff = fabs(temp - tempOff[i]);
+    if (dOn < nearest) nearest = dOn;
+    if (dOff < nearest) nearest = dOff;
   }
+  return nearest;
+}
+
+// Setters
+template <uint8_t N>
+void RelayController<N>::setRelayMode(int index, Mode mode) {
+  if (relayModes[index] == mode) return;
+  resetPid(index);
+  relayModes[index] = mode;
+  notify(index, RELAY_CHANGED_MODE);
+}
+
+template <uint8_t N>
+void RelayController<N>::setRelayType(int index, RelayType type) {
+  if (relayTypes[index] == type) return;
+  resetPid(index);
+  relayTypes[index] = type;
+  notify(index, RELAY_CHANGED_TYPE);
 }
 
-void RelayController::setTempThresholds(int index, float tOn, float tOff) {
-  if (index >= 0 && index < 4) {
-    tempOn[index] = tOn;
-    tempOff[index] = tOff;
+template <uint8_t N>
+void RelayController<N>::setTempThresholds(int index, float tOn, float tOff, bool persist) {
+  bool changed = tempOn[index] != tOn || tempOff[index] != tOff;
+  if (persist) {
+    changed |= baseTempOn[index] != tOn || baseTempOff[index] != tOff;
+    baseTempOn[index] = tOn;
+    baseTempOff[index] = tOff;
   }
+  if (!changed) return;
+  tempOn[index] = tOn;
+  tempOff[index] = tOff;
+  notify(index, RELAY_CHANGED_THRESHOLDS | (persist ? 0 : RELAY_CHANGED_TRANSIENT));
+}
+
+template <uint8_t N>
+void RelayController<N>::setPidSettings(int index, const PidSettings& settings) {
+  PidSettings p = settings;
+  p.windowSec = constrain(settings.windowSec, PID_MIN_WINDOW, PID_MAX_WINDOW);
+  const PidSettings& cur = pid[index];
+  if (p.kp == cur.kp && p.ki == cur.ki && p.kd == cur.kd && p.windowSec == cur.windowSec) return;
+  pid[index] = p;
+  notify(index, RELAY_CHANGED_PID);
+}
+
+template <uint8_t N>
+void RelayController<N>::setCycleLimits(int index, const CycleLimits& l) {
+  CycleLimits c = l;
+  if (c.maxCyclesPerHour > RELAY_CYCLE_HISTORY) c.maxCyclesPerHour = RELAY_CYCLE_HISTORY;
+  const CycleLimits& cur = limits[index];
+  if (c.minOnSec == cur.minOnSec && c.minOffSec == cur.minOffSec && c.maxCyclesPerHour == cur.maxCyclesPerHour) return;
+  limits[index] = c;
+  notify(index, RELAY_CHANGED_CYCLE);
+}
+
+// Change events
+template <uint8_t N>
+bool RelayController<N>::subscribe(RelayListener listener) {
+  if (listenerCount >= RELAY_MAX_LISTENERS) return false;
+  listeners[listenerCount++] = listener;
+  return true;
+}
+
+template <uint8_t N>
+void RelayController<N>::notify(int i, uint8_t changes) {
+  RelayEvent e;
+  e.index = i;
+  e.changes = changes;
+  e.version = ++versions[i];
+  e.state = relayStates[i];
+  e.deferred = pending[i] ? pendingState[i] : -1;
+  e.mode = relayModes[i];
+  for (uint8_t k = 0; k < listenerCount; k++) listeners[k](e);
 }
 
 // Utility
-String RelayController::modeToString(Mode m) {
+template <uint8_t N>
+String RelayController<N>::modeToString(Mode m) {
   switch (m) {
     case AUTO: return "AUTO";
     case MANUAL_ON: return "MANUAL_ON";
     case MANUAL_OFF: return "MANUAL_OFF";
+    case PID: return "PID";
   }
   return "AUTO";
 }
 
-String RelayController::typeToString(RelayType t) {
+template <uint8_t N>
+String RelayController<N>::typeToString(RelayType t) {
   switch (t) {
     case HEATING: return "HEATING";
     case COOLING: return "COOLING";
@@ -129,3 +437,6 @@ String RelayController::typeToString(RelayType t) {
   }
   return "HEATING";
 }
+
+// The one instantiation this build needs, for the board's relay table
+template class RelayController<RELAY_COUNT>;
@@ -2,41 +2,167 @@
 #define RELAY_CONTROLLER_H
 
 #include <Arduino.h>
+#include <functional>
 #include "Config.h"
 #include "SystemLogger.h"
 
-enum Mode { AUTO = 0, MANUAL_ON = 1, MANUAL_OFF = 2 };
+// AUTO is bang-bang hysteresis between tempOn and tempOff. PID regulates to
+// their midpoint and switches the relay with a time-proportioned duty cycle;
+// the relay type gives the direction (HEATING heats, COOLING/GENERIC cool).
+enum Mode { AUTO = 0, MANUAL_ON = 1, MANUAL_OFF = 2, PID = 3 };
 enum RelayType { HEATING = 0, COOLING = 1, GENERIC = 2, MANUAL_ONLY = 3 };
 
+// Short-cycle protection. Transitions that would break these are deferred
+// and applied by update() once allowed.
+struct CycleLimits {
+  uint16_t minOnSec;
+  uint16_t minOffSec;
+  uint8_t maxCyclesPerHour;   // OFF->ON starts in any 60 min, 0 = unlimited
+};
+
+struct PidSettings {
+  float kp;
+  float ki;
+  float kd;
+  uint16_t windowSec;
+};
+
+// What changed in a RelayEvent
+enum RelayChange : uint8_t {
+  RELAY_CHANGED_STATE      = 1 << 0,  // the output switched
+  RELAY_CHANGED_DEFERRED   = 1 << 1,  // a deferred transition started, changed or ended
+  RELAY_CHANGED_MODE       = 1 << 2,
+  RELAY_CHANGED_TYPE       = 1 << 3,
+  RELAY_CHANGED_THRESHOLDS = 1 << 4,
+  RELAY_CHANGED_PID        = 1 << 5,  // gains or window, not the duty
+  RELAY_CHANGED_CYCLE      = 1 << 6,
+  RELAY_CHANGED_TRANSIENT  = 1 << 7,  // settings applied by the schedule, not to be saved
+};
+
+constexpr uint8_t RELAY_CHANGED_SETTINGS = RELAY_CHANGED_MODE | RELAY_CHANGED_TYPE | RELAY_CHANGED_THRESHOLDS
+                                         | RELAY_CHANGED_PID | RELAY_CHANGED_CYCLE;
+
+// Published to subscribers whenever a relay changes. version counts events
+// per relay, so "has anything changed since X" is one integer compare.
+struct RelayEvent {
+  uint8_t index;
+  uint8_t changes;    // RelayChange bits
+  uint32_t version;
+  bool state;
+  int8_t deferred;    // state a deferred transition waits for, -1 = none
+  Mode mode;
+};
+
+typedef std::function<void(const RelayEvent&)> RelayListener;
+
+// One controller for the whole relay board. N is the relay count, fixed at
+// compile time from the pin table in Config.h; the table's size is checked
+// against N when the controller is constructed. Accessors take an index in
+// [0, N) without checking it — external input (web, backend commands,
+// config, schedule) is validated with isValidIndex() where it enters.
+template <uint8_t N>
 class RelayController {
 public:
-  RelayController();
+  static constexpr uint8_t COUNT = N;
+
+  explicit RelayController(const uint8_t (&pinTable)[N]);
+
+  static bool isValidIndex(int index) { return index >= 0 && index < N; }
 
   void begin();
   void applyRelayLogic(float currentTemp);
 
+  // Call every loop pass. Switches PID relays according to their position
+  // in the current time-proportioning window and applies deferred
+  // transitions once the cycle limits allow. Cheap when neither applies.
+  void update();
+
   // Getters
   bool getRelayState(int index) const;
   Mode getRelayMode(int index) const;
   RelayType getRelayType(int index) const;
-  float getTempOn(int index) const;
+  float getTempOn(int index) const;           // in effect, schedule included
   float getTempOff(int index) const;
+  float getBaseTempOn(int index) const;       // as last set by the user; what's saved
+  float getBaseTempOff(int index) const;
+  const CycleLimits& getCycleLimits(int index) const;
+  bool isDeferred(int index) const;              // a transition is waiting on the cycle limits
+  bool getDeferredState(int index) const;        // the state it is waiting to switch to
+  unsigned long getDeferredRemaining(int index) const;  // seconds until it is allowed
+  const PidSettings& getPidSettings(int index) const;
+  float getPidOutput(int index) const;   // last computed duty, 0..1
+
+  uint32_t getVersion(int index) const;  // bumps with every RelayEvent
+
+  // Distance in °C from `temp` to the nearest ON/OFF threshold of any relay
+  // that is actually under temperature control (AUTO or PID, not MANUAL_ONLY).
+  // Returns a large value when no relay is.
+  float getThresholdDistance(float temp) const;
 
-  // Setters
+  // Setters. Each publishes a RelayEvent if the value actually changed.
+  // persist=false marks threshold changes the schedule makes at run time:
+  // they take effect but leave the base thresholds alone.
   void setRelayMode(int index, Mode mode);
   void setRelayType(int index, RelayType type);
-  void setTempThresholds(int index, float tempOn, float tempOff);
+  void setTempThresholds(int index, float tempOn, float tempOff, bool persist = true);
+  void setCycleLimits(int index, const CycleLimits& limits);
+  void setPidSettings(int index, const PidSettings& settings);
+
+  // Listeners are called synchronously, after the change has been applied.
+  // Returns false when all RELAY_MAX_LISTENERS slots are taken.
+  bool subscribe(RelayListener listener);
 
   // Utility
   static String modeToString(Mode m);
   static String typeToString(RelayType t);
 
 private:
-  bool relayStates[4];
-  Mode relayModes[4];
-  RelayType relayTypes[4];
-  float tempOn[4];
-  float tempOff[4];
+  const uint8_t* pins;
+  static const uint32_t GPIO16_BIT = 1UL << 16;
+  uint32_t pinMask;            // GPIO bits of every relay pin (bit 16 = GPIO16)
+  uint32_t drivenOffMask;      // GPIO bits last left HIGH (relay OFF)
+  bool relayStates[N];
+  Mode relayModes[N];
+  RelayType relayTypes[N];
+  float tempOn[N];
+  float tempOff[N];
+  float baseTempOn[N];
+  float baseTempOff[N];
+
+  // Short-cycle state, per relay
+  CycleLimits limits[N];
+  unsigned long lastChangeMs[N];
+  unsigned long cycleStarts[N][RELAY_CYCLE_HISTORY];  // ring of recent OFF->ON times, 0 = empty
+  uint8_t cycleHead[N];
+  bool pending[N];
+  bool pendingState[N];
+
+  bool requestState(int index, bool want, unsigned long now);
+  void writeOutputs();
+
+  // Change events
+  uint32_t versions[N];
+  RelayListener listeners[RELAY_MAX_LISTENERS];
+  uint8_t listenerCount;
+
+  void notify(int index, uint8_t changes);
+  unsigned long blockedForMs(int index, bool want, unsigned long now) const;
+
+  // PID state, per relay
+  PidSettings pid[N];
+  float pidIntegral[N];        // I term, already scaled by ki (duty units)
+  float pidLastTemp[N];
+  unsigned long pidLastMs[N];  // 0 = no previous sample
+  float pidOutput[N];
+  float windowDuty[N];         // duty latched at the start of the window
+  unsigned long windowStart[N];
+
+  void resetPid(int index);
+  float computePid(int index, float currentTemp);
+  bool timeProportionedState(int index, unsigned long now);
 };
 
+// The board's relay controller; every other module refers to it by this name
+using Relays = RelayController<RELAY_COUNT>;
+
 #endif // RELAY_CONTROLLER_H
@@ -0,0 +1,64 @@
+#include "RollupTier.h"
+
+RollupTier::RollupTier(const char* path, uint32_t periodSec, uint32_t capacity)
+  : store(path, sizeof(RollupRecord), capacity), period(periodSec) {
+  for (uint8_t s = 0; s < MAX_TEMP_SENSORS; s++) {
+    open[s].start = 0;
+  }
+}
+
+void RollupTier::add(uint32_t timestamp, int16_t centiC, uint8_t sensorId) {
+  if (sensorId >= MAX_TEMP_SENSORS) return;
+
+  uint32_t start = timestamp - (timestamp % period);
+  Bucket& b = open[sensorId];
+  if (b.start != start) {
+    closeBucket(sensorId);
+    b.start = start;
+    b.sum = 0;
+    b.count = 0;
+    b.minC = centiC;
+    b.maxC = centiC;
+  }
+
+  b.sum += centiC;
+  if (b.count < UINT16_MAX) b.count++;
+  if (centiC < b.minC) b.minC = centiC;
+  if (centiC > b.maxC) b.maxC = centiC;
+}
+
+bool RollupTier::openBucket(uint8_t sensorId, RollupRecord& rec) const {
+  if (sensorId >= MAX_TEMP_SENSORS) return false;
+  const Bucket& b = open[sensorId];
+  if (b.start == 0 || b.count == 0) return false;
+
+  rec.bucketStart = b.start;
+  rec.minC = b.minC;
+  rec.avgC = (int16_t)(b.sum / (int32_t)b.count);
+  rec.maxC = b.maxC;
+  rec.count = b.count;
+  rec.sensorId = sensorId;
+  memset(rec.reserved, 0, sizeof(rec.reserved));
+  return true;
+}
+
+void RollupTier::closeBucket(uint8_t sensorId) {
+  RollupRecord rec;
+  if (!openBucket(sensorId, rec)) return;
+  store.append(&rec);
+  open[sensorId].start = 0;
+}
+
+void RollupTier::flush() {
+  for (uint8_t s = 0; s < MAX_TEMP_SENSORS; s++) {
+    closeBucket(s);
+  }
+  store.flush();
+}
+
+void RollupTier::clear() {
+  for (uint8_t s = 0; s < MAX_TEMP_SENSORS; s++) {
+    open[s].start = 0;
+  }
+  store.clear();
+}
@@ -0,0 +1,59 @@
+#ifndef ROLLUP_TIER_H
+#define ROLLUP_TIER_H
+
+#include <Arduino.h>
+#include "Config.h"
+#include "TimeSeriesStore.h"
+
+// One closed min/avg/max bucket. 16 bytes, so 256 fit in a 4 KB flash block.
+struct __attribute__((packed)) RollupRecord {
+  uint32_t bucketStart;  // unix seconds, aligned to the tier period
+  int16_t  minC;         // 1/100 °C
+  int16_t  avgC;
+  int16_t  maxC;
+  uint16_t count;        // raw samples folded into this bucket
+  uint8_t  sensorId;
+  uint8_t  reserved[3];
+};
+
+// Fixed-period downsampling tier (1-min, 15-min, hourly). Each sensor has
+// one open bucket in RAM that add() updates in O(1); when a sample lands in
+// a later period the bucket is closed and appended to the tier's own
+// TimeSeriesStore. Only NTP-synced timestamps are rolled up, so buckets are
+// always wall-clock aligned.
+//
+// flush() (restart / OTA) closes the open buckets early so they aren't lost;
+// samples later in the same period then start a second record with the
+// same bucketStart, which range readers merge.
+class RollupTier {
+public:
+  RollupTier(const char* path, uint32_t periodSec, uint32_t capacity);
+
+  bool begin() { return store.begin(); }
+  void add(uint32_t timestamp, int16_t centiC, uint8_t sensorId);
+  void flush();
+  void flushIfDue() { store.flushIfDue(); }
+  void clear();
+
+  uint32_t getPeriod() const { return period; }
+  // The sensor's open bucket as a record so far; false if it has none
+  bool openBucket(uint8_t sensorId, RollupRecord& out) const;
+  const TimeSeriesStore& getStore() const { return store; }
+
+private:
+  struct Bucket {
+    uint32_t start;     // 0 = no open bucket
+    int32_t sum;
+    uint16_t count;
+    int16_t minC;
+    int16_t maxC;
+  };
+
+  TimeSeriesStore store;
+  uint32_t period;
+  Bucket open[MAX_TEMP_SENSORS];
+
+  void closeBucket(uint8_t sensorId);
+};
+
+#endif // ROLLUP_TIER_H
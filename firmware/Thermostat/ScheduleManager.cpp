@@ -0,0 +1,255 @@
+#include "ScheduleManager.h"
+#include "TimeSeriesStore.h"
+#include <time.h>
+
+ScheduleManager::ScheduleManager(Relays& relayCtrl)
+  : relayController(relayCtrl), entryCount(0), lastMinuteOfWeek(-1) {
+  for (int r = 0; r < RELAY_COUNT; r++) {
+    transitionCount[r] = 0;
+    applied[r] = 0xFF;
+  }
+}
+
+void ScheduleManager::begin() {
+  if (load() && entryCount > 0) {
+    logger.addLog("Schedule loaded: " + String(entryCount) + " entries");
+  }
+}
+
+uint8_t ScheduleManager::tick() {
+  time_t now = time(nullptr);
+  if (now < 1000000000) return 0; // NTP not synced yet
+
+  struct tm t;
+  localtime_r(&now, &t);
+  int mow = t.tm_wday * 1440 + t.tm_hour * 60 + t.tm_min;
+  if (mow == lastMinuteOfWeek) return 0;
+  lastMinuteOfWeek = mow;
+
+  uint8_t changed = 0;
+  for (int r = 0; r < RELAY_COUNT; r++) {
+    if (transitionCount[r] == 0) continue;
+    uint8_t idx = activeTransition(r, mow);
+    if (idx == applied[r]) continue;
+    applied[r] = idx;
+
+    const ScheduleEntry& e = entries[transitions[r][idx].entry];
+    float on = TimeSeriesStore::fromCenti(e.onC);
+    float off = TimeSeriesStore::fromCenti(e.offC);
+    relayController.setTempThresholds(r, on, off, false);
+    logger.addLog("Schedule: relay " + String(r + 1) + " ON=" + String(on, 1) + "C, OFF=" + String(off, 1) + "C");
+    changed |= 1 << r;
+  }
+  return changed;
+}
+
+// Last transition at or before `mow`, wrapping to last week's final one.
+uint8_t ScheduleManager::activeTransition(int r, uint16_t mow) const {
+  const Transition* tr = transitions[r];
+  uint8_t n = transitionCount[r];
+  uint8_t idx = hourIndex[r][mow / 60];
+  if (tr[idx].minuteOfWeek > mow) {
+    // Hour starts in last week's tail; the week's first transition may still
+    // fall inside this hour.
+    if (tr[0].minuteOfWeek > mow) return idx;
+    idx = 0;
+  }
+  while (idx + 1 < n && tr[idx + 1].minuteOfWeek <= mow) idx++;
+  return idx;
+}
+
+// Checks the expanded size, which compile() has no room to exceed.
+bool ScheduleManager::validate(const ScheduleEntry* list, uint8_t count, String& error) const {
+  uint8_t perRelay[RELAY_COUNT] = {0};
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t days = list[i].days & 0x7F;
+    while (days) {
+      perRelay[list[i].relay] += days & 1;
+      days >>= 1;
+    }
+  }
+  for (int r = 0; r < RELAY_COUNT; r++) {
+    if (perRelay[r] > SCHEDULE_MAX_TRANSITIONS) {
+      error = "relay " + String(r + 1) + ": more than " + String(SCHEDULE_MAX_TRANSITIONS) + " transitions per week";
+      return false;
+    }
+  }
+  return true;
+}
+
+// `list` must have passed validate().
+void ScheduleManager::compile(const ScheduleEntry* list, uint8_t count) {
+  memcpy(entries, list, count * sizeof(ScheduleEntry));
+  entryCount = count;
+
+  for (int r = 0; r < RELAY_COUNT; r++) {
+    Transition* tr = transitions[r];
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < count; i++) {
+      if (entries[i].relay != r) continue;
+      for (uint8_t d = 0; d < 7; d++) {
+        if (!(entries[i].days & (1 << d))) continue;
+        Transition t = {(uint16_t)(d * 1440 + entries[i].minute), i};
+        // Insertion sort, stable so a later entry lands after an earlier one
+        // at the same minute
+        uint8_t j = n++;
+        while (j > 0 && tr[j - 1].minuteOfWeek > t.minuteOfWeek) {
+          tr[j] = tr[j - 1];
+          j--;
+        }
+        tr[j] = t;
+      }
+    }
+
+    // Same minute twice: the later entry wins
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < n; i++) {
+      if (kept > 0 && tr[kept - 1].minuteOfWeek == tr[i].minuteOfWeek) kept--;
+      tr[kept++] = tr[i];
+    }
+    // A relay that just lost its schedule goes back to its own setpoint;
+    // the scheduled one was never saved.
+    if (kept == 0 && transitionCount[r] > 0) {
+      relayController.setTempThresholds(r, relayController.getBaseTempOn(r), relayController.getBaseTempOff(r), false);
+    }
+    transitionCount[r] = kept;
+
+    // Before the week's first transition, last week's final one is active
+    int idx = -1;
+    for (uint16_t h = 0; h < 168; h++) {
+      while (idx + 1 < kept && tr[idx + 1].minuteOfWeek <= h * 60) idx++;
+      hourIndex[r][h] = idx < 0 ? kept - 1 : idx;
+    }
+    applied[r] = 0xFF;
+  }
+  lastMinuteOfWeek = -1; // re-evaluate on the next tick
+}
+
+bool ScheduleManager::setFromJson(JsonVariantConst doc, String& error) {
+  ScheduleEntry list[RELAY_COUNT * SCHEDULE_MAX_ENTRIES];
+  uint8_t count = 0;
+  return parseJson(doc, list, count, error) && setEntries(list, count, error);
+}
+
+bool ScheduleManager::parseJson(JsonVariantConst doc, ScheduleEntry* list, uint8_t& count, String& error) {
+  count = 0;
+  bool seen[RELAY_COUNT] = {false};
+
+  JsonArrayConst relays = doc["relays"];
+  if (relays.isNull()) {
+    error = "missing relays";
+    return false;
+  }
+
+  for (JsonObjectConst relay : relays) {
+    int num = relay["relay_number"] | 0;
+    if (!Relays::isValidIndex(num - 1) || seen[num - 1]) {
+      error = "bad or repeated relay_number";
+      return false;
+    }
+    seen[num - 1] = true;
+
+    JsonArrayConst items = relay["entries"];
+    if (items.size() > SCHEDULE_MAX_ENTRIES) {
+      error = "relay " + String(num) + ": more than " + String(SCHEDULE_MAX_ENTRIES) + " entries";
+      return false;
+    }
+    for (JsonObjectConst item : items) {
+      int days = item["days"] | 0;
+      int at = item["at"] | -1;
+      if (days < 1 || days > 127 || at < 0 || at >= 1440
+          || !item["temp_on"].is<float>() || !item["temp_off"].is<float>()) {
+        error = "relay " + String(num) + ": bad entry";
+        return false;
+      }
+      ScheduleEntry& e = list[count++];
+      e.relay = num - 1;
+      e.days = days;
+      e.minute = at;
+      e.onC = TimeSeriesStore::toCenti(item["temp_on"].as<float>());
+      e.offC = TimeSeriesStore::toCenti(item["temp_off"].as<float>());
+    }
+  }
+  return true;
+}
+
+// Saved before it goes live, so a failed write leaves the running schedule
+// as it was.
+bool ScheduleManager::setEntries(const ScheduleEntry* list, uint8_t count, String& error) {
+  if (!validate(list, count, error)) return false;
+  if (!save(list, count)) {
+    error = "could not write " SCHEDULE_FILE;
+    return false;
+  }
+  compile(list, count);
+  logger.addLog("Schedule updated: " + String(count) + " entries");
+  return true;
+}
+
+void ScheduleManager::toJson(JsonDocument& doc) const {
+  JsonArray relays = doc["relays"].to<JsonArray>();
+  for (int r = 0; r < RELAY_COUNT; r++) {
+    if (transitionCount[r] == 0) continue;
+    JsonObject relay = relays.add<JsonObject>();
+    relay["relay_number"] = r + 1;
+    JsonArray items = relay["entries"].to<JsonArray>();
+    for (uint8_t i = 0; i < entryCount; i++) {
+      if (entries[i].relay != r) continue;
+      JsonObject item = items.add<JsonObject>();
+      item["days"]     = entries[i].days;
+      item["at"]       = entries[i].minute;
+      item["temp_on"]  = TimeSeriesStore::fromCenti(entries[i].onC);
+      item["temp_off"] = TimeSeriesStore::fromCenti(entries[i].offC);
+    }
+  }
+}
+
+bool ScheduleManager::isScheduled(int relay) const {
+  return Relays::isValidIndex(relay) && transitionCount[relay] > 0;
+}
+
+bool ScheduleManager::load() {
+  File f = LittleFS.open(SCHEDULE_FILE, "r");
+  if (!f) return false;
+
+  FileHeader h;
+  ScheduleEntry list[RELAY_COUNT * SCHEDULE_MAX_ENTRIES];
+  bool ok = f.read((uint8_t*)&h, sizeof(h)) == sizeof(h)
+         && h.magic == MAGIC
+         && h.version == VERSION
+         && h.count <= RELAY_COUNT * SCHEDULE_MAX_ENTRIES
+         && f.read((uint8_t*)list, h.count * sizeof(ScheduleEntry)) == h.count * sizeof(ScheduleEntry);
+  f.close();
+
+  String error;
+  if (ok) {
+    for (uint8_t i = 0; i < h.count; i++) {
+      if (list[i].relay >= RELAY_COUNT || list[i].minute >= 1440) ok = false;
+    }
+  }
+  if (!ok || !validate(list, h.count, error)) {
+    logger.addLog(String("WARN: Ignoring invalid " SCHEDULE_FILE " ") + error);
+    return false;
+  }
+  compile(list, h.count);
+  return true;
+}
+
+// Written beside the old file and renamed over it, so a failed write
+// leaves the saved schedule as it was too.
+bool ScheduleManager::save(const ScheduleEntry* list, uint8_t count) const {
+  File f = LittleFS.open(SCHEDULE_FILE ".tmp", "w");
+  if (!f) {
+    logger.addLog("ERROR: Failed to save schedule");
+    return false;
+  }
+  FileHeader h = {MAGIC, VERSION, count, 0};
+  bool ok = f.write((const uint8_t*)&h, sizeof(h)) == sizeof(h)
+         && f.write((const uint8_t*)list, count * sizeof(ScheduleEntry)) == count * sizeof(ScheduleEntry);
+  f.close();
+  if (!ok || !LittleFS.rename(SCHEDULE_FILE ".tmp", SCHEDULE_FILE)) {
+    LittleFS.remove(SCHEDULE_FILE ".tmp");
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,85 @@
+#ifndef SCHEDULE_MANAGER_H
+#define SCHEDULE_MANAGER_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+#include "Config.h"
+#include "SystemLogger.h"
+#include "RelayController.h"
+
+// One uploaded schedule line: from `minute` on every day in `days` the relay
+// uses these thresholds until its next transition. 8 bytes on flash.
+struct __attribute__((packed)) ScheduleEntry {
+  uint8_t  relay;    // 0..RELAY_COUNT-1
+  uint8_t  days;     // bit 0 = Sunday ... bit 6 = Saturday (tm_wday)
+  uint16_t minute;   // minute of day, local time
+  int16_t  onC;      // 1/100 °C
+  int16_t  offC;
+};
+
+// Weekly setpoint schedule per relay. Entries are kept as uploaded and
+// compiled into a per-relay table of transitions sorted by minute of the
+// week, plus an hour-of-week index into it, so finding the active entry is
+// one table lookup and at most a few steps forward. Scheduled thresholds are
+// applied in RAM only (no config rewrite); a manual change holds until the
+// relay's next transition.
+class ScheduleManager {
+public:
+  ScheduleManager(Relays& relayCtrl);
+
+  void begin();
+
+  // Call every loop pass. Does work at most once per minute and only once
+  // NTP has synced. Returns a bitmask of relays whose thresholds changed.
+  uint8_t tick();
+
+  // Replace the whole schedule from
+  //   {"relays":[{"relay_number":1,"entries":[
+  //     {"days":62,"at":390,"temp_on":20.5,"temp_off":21.5}, ...]}, ...]}
+  // ("at" = minute of day). Relays not listed become unscheduled and go
+  // back to their saved thresholds. On failure nothing changes and `error`
+  // says why.
+  bool setFromJson(JsonVariantConst doc, String& error);
+
+  // The two halves of setFromJson(): decode into `list` (room for
+  // RELAY_COUNT * SCHEDULE_MAX_ENTRIES), then save, compile and apply it
+  static bool parseJson(JsonVariantConst doc, ScheduleEntry* list, uint8_t& count, String& error);
+  bool setEntries(const ScheduleEntry* list, uint8_t count, String& error);
+  void toJson(JsonDocument& doc) const;
+
+  bool isScheduled(int relay) const;
+
+private:
+  struct Transition {
+    uint16_t minuteOfWeek;
+    uint8_t entry;           // index into entries[]
+  };
+
+  static const uint32_t MAGIC = 0x44484353; // "SCHD"
+  static const uint8_t VERSION = 1;
+
+  struct __attribute__((packed)) FileHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t count;
+    uint16_t reserved;
+  };
+
+  Relays& relayController;
+  ScheduleEntry entries[RELAY_COUNT * SCHEDULE_MAX_ENTRIES];
+  uint8_t entryCount;
+  Transition transitions[RELAY_COUNT][SCHEDULE_MAX_TRANSITIONS];
+  uint8_t transitionCount[RELAY_COUNT];
+  uint8_t hourIndex[RELAY_COUNT][168];   // active transition at the start of each hour of the week
+  uint8_t applied[RELAY_COUNT];          // transition last applied, 0xFF = none
+  int lastMinuteOfWeek;
+
+  bool validate(const ScheduleEntry* list, uint8_t count, String& error) const;
+  void compile(const ScheduleEntry* list, uint8_t count);
+  uint8_t activeTransition(int relay, uint16_t minuteOfWeek) const;
+  bool load();
+  bool save(const ScheduleEntry* list, uint8_t count) const;
+};
+
+#endif // SCHEDULE_MANAGER_H
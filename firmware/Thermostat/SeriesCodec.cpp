@@ -0,0 +1,48 @@
+#include "SeriesCodec.h"
+
+SeriesEncoder::SeriesEncoder(bool withStats) : withStats(withStats) {
+  memset(state, 0, sizeof(state));
+}
+
+size_t SeriesEncoder::writeHeader(uint8_t* out) const {
+  out[0] = 'T';
+  out[1] = 'S';
+  out[2] = VERSION;
+  out[3] = withStats ? FLAG_STATS : 0;
+  return HEADER_BYTES;
+}
+
+size_t SeriesEncoder::encode(uint8_t* out, uint32_t ts, uint8_t sensorId,
+                             int16_t avgC, int16_t minC, int16_t maxC, uint32_t count) {
+  if (sensorId >= MAX_TEMP_SENSORS) return 0;
+  State& s = state[sensorId];
+
+  // A sensor's first point is encoded against zero, i.e. as absolute values.
+  // 64-bit arithmetic keeps the jump between boot-relative and wall-clock
+  // timestamps exact.
+  int64_t delta = (int64_t)ts - s.prevTs;
+  size_t n = putVarint(out, sensorId);
+  n += putVarint(out + n, zigzag(delta - s.prevDelta));
+  n += putVarint(out + n, zigzag((int64_t)avgC - s.prevC));
+  if (withStats) {
+    n += putVarint(out + n, zigzag((int64_t)minC - avgC));
+    n += putVarint(out + n, zigzag((int64_t)maxC - avgC));
+    n += putVarint(out + n, zigzag((int64_t)count - s.prevCount));
+    s.prevCount = count;
+  }
+
+  s.prevTs = ts;
+  s.prevDelta = delta;
+  s.prevC = avgC;
+  return n;
+}
+
+size_t SeriesEncoder::putVarint(uint8_t* out, uint64_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (uint8_t)v;
+  return n;
+}
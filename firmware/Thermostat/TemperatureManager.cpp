@@ -1,71 +1,244 @@
 #include "TemperatureManager.h"
 
 TemperatureManager::TemperatureManager()
-  : oneWire(ONE_WIRE_BUS), sensors(&oneWire), currentTemp(0.0) {
+  : oneWire(ONE_WIRE_BUS), sensors(&oneWire), logStore(LOG_FILE, sizeof(TempRecord), TEMP_LOG_CAPACITY),
+    rollups{{ROLLUP_1M_FILE, 60, ROLLUP_1M_CAPACITY},
+            {ROLLUP_15M_FILE, 900, ROLLUP_15M_CAPACITY},
+            {ROLLUP_1H_FILE, 3600, ROLLUP_1H_CAPACITY}},
+    sensorCount(1), discovered(false), lastDiscovery(0), missingLogged(false),
+    readState(READ_IDLE), conversionStart(0), conversionTime(0),
+    sampleInterval((unsigned long)DEFAULT_UPDATE_FREQUENCY * 1000), resolution(12),
+    lastResolutionChange(0) {
+  for (uint8_t s = 0; s < MAX_TEMP_SENSORS; s++) {
+    memset(slots[s].addr, 0, sizeof(DeviceAddress));
+    slots[s].currentTemp = 0.0;
+    slots[s].windowLen = 0;
+    slots[s].windowPos = 0;
+    slots[s].ema = 0.0f;
+    slots[s].emaValid = false;
+    slots[s].lastAcceptMs = 0;
+    slots[s].ratePerMin = 0.0f;
+    slots[s].result = {false, 0.0f, 0.0f, nullptr};
+  }
 }
 
 void TemperatureManager::begin() {
   sensors.begin();
-  logger.addLog("DS18B20 sensor initialized");
+  // We time the conversion ourselves (see pollRead) instead of letting
+  // requestTemperatures() block for up to 750 ms per sample.
+  sensors.setWaitForConversion(false);
+  discoverSensors();
+  resolution = sensors.getResolution();
+
+  if (LittleFS.exists(LEGACY_LOG_FILE)) {
+    LittleFS.remove(LEGACY_LOG_FILE);
+    logger.addLog("Removed legacy CSV temp log");
+  }
+  logStore.begin();
+  for (int t = 0; t < ROLLUP_COUNT; t++) {
+    rollups[t].begin();
+  }
 }
 
-TempReadResult TemperatureManager::readTemperatureWithValidation() {
-  TempReadResult result = {false, 0.0f, 0, nullptr};
-  const char* lastReason = nullptr;
-
-  for (int attempt = 0; attempt < 2; attempt++) {
-    result.attemptsTaken = attempt + 1;
-
-    float samples[TEMP_NUM_SAMPLES];
-    bool sawDisconnect = false;
-    bool sawOutOfRange = false;
-    bool allValid = true;
-
-    for (int i = 0; i < TEMP_NUM_SAMPLES; i++) {
-      sensors.requestTemperatures();
-      delay(TEMP_SAMPLE_DELAY);
-      samples[i] = sensors.getTempCByIndex(0);
-
-      if (samples[i] == -127.0f) {
-        sawDisconnect = true;
-        allValid = false;
-        break;
-      }
-      if (samples[i] < TEMP_MIN_VALID || samples[i] > TEMP_MAX_VALID) {
-        sawOutOfRange = true;
-        allValid = false;
-        break;
-      }
-      yield(); // Feed watchdog
+// Enumerate the bus once and cache every ROM so reads can address each
+// scratchpad directly instead of re-searching the bus per getTempCByIndex().
+// The count comes from the last sensors.begin(), so a retry calls that first.
+void TemperatureManager::discoverSensors() {
+  lastDiscovery = millis();
+  uint8_t found = 0;
+  uint8_t onBus = sensors.getDeviceCount();
+  for (uint8_t i = 0; i < onBus && found < MAX_TEMP_SENSORS; i++) {
+    if (sensors.getAddress(slots[found].addr, i)) {
+      found++;
     }
+  }
+
+  discovered = found > 0;
+  // Keep one placeholder slot with a zeroed ROM when the bus is empty, so a
+  // missing probe still surfaces as a "disconnect" read failure.
+  sensorCount = discovered ? found : 1;
+
+  if (!discovered) {
+    if (!missingLogged) logger.addLog("WARN: No DS18B20 sensors found on bus");
+    missingLogged = true;
+    return;
+  }
+  missingLogged = false;
+  if (onBus > MAX_TEMP_SENSORS) {
+    logger.addLog("WARN: " + String(onBus) + " sensors on bus, using first " + String(MAX_TEMP_SENSORS));
+  }
+  for (uint8_t s = 0; s < sensorCount; s++) {
+    logger.addLog("DS18B20 sensor " + String(s) + ": " + getSensorAddress(s));
+  }
+  logger.addLog(String(sensorCount) + " DS18B20 sensor(s) initialized");
+}
+
+TempReadResult TemperatureManager::readTemperatureWithValidation() {
+  if (!startRead()) {
+    TempReadResult busy = {false, 0.0f, 0.0f, "busy"};
+    return busy;
+  }
+  while (!pollRead()) {
+    delay(10); // Feeds watchdog
+  }
+  return slots[0].result;
+}
+
+bool TemperatureManager::startRead() {
+  if (readState != READ_IDLE) return false;
+  // A probe that was unplugged at boot gets picked up by a fresh bus search,
+  // at most once per TEMP_REDISCOVER_INTERVAL.
+  if (!discovered && millis() - lastDiscovery >= TEMP_REDISCOVER_INTERVAL) {
+    sensors.begin();
+    sensors.setWaitForConversion(false);
+    discoverSensors();
+  }
+
+  sensors.requestTemperatures(); // one Convert T for every sensor on the bus
+  conversionStart = millis();
+  conversionTime = sensors.millisToWaitForConversion(sensors.getResolution());
+  readState = READ_CONVERTING;
+  return true;
+}
+
+bool TemperatureManager::pollRead() {
+  if (readState == READ_IDLE) return false;
+  if (millis() - conversionStart < conversionTime) return false;
 
-    if (!allValid) {
-      lastReason = sawDisconnect ? "disconnect" : "out-of-range";
-      delay(TEMP_RETRY_DELAY);
-      continue;
+  // The conversion has finished: read each sensor straight from its
+  // scratchpad by ROM address and run it through the filter.
+  for (uint8_t s = 0; s < sensorCount; s++) {
+    SensorSlot& slot = slots[s];
+    float t = sensors.getTempC(slot.addr);
+    if (t == -127.0f) {
+      slot.result = {false, 0.0f, 0.0f, "disconnect"};
+    } else if (t < TEMP_MIN_VALID || t > TEMP_MAX_VALID) {
+      slot.result = {false, 0.0f, t, "out-of-range"};
+    } else {
+      filterSample(slot, t);
     }
+  }
+
+  readState = READ_IDLE;
+  return true;
+}
+
+// Hampel gate + EMA. The sample always enters the window (so a real step
+// change takes over the median after a few reads), but only samples close
+// enough to the median update the smoothed value.
+void TemperatureManager::filterSample(SensorSlot& slot, float t) {
+  slot.window[slot.windowPos] = t;
+  slot.windowPos = (slot.windowPos + 1) % TEMP_FILTER_WINDOW;
+  if (slot.windowLen < TEMP_FILTER_WINDOW) slot.windowLen++;
 
-    float avg = (samples[0] + samples[1] + samples[2]) / 3.0f;
-    float maxDiff = 0.0f;
-    for (int i = 0; i < TEMP_NUM_SAMPLES; i++) {
-      float d = fabs(samples[i] - avg);
-      if (d > maxDiff) maxDiff = d;
+  // Too little history to judge; accept and let the window fill
+  if (slot.windowLen >= 3) {
+    float work[TEMP_FILTER_WINDOW];
+    memcpy(work, slot.window, slot.windowLen * sizeof(float));
+    float med = median(work, slot.windowLen);
+    for (uint8_t i = 0; i < slot.windowLen; i++) work[i] = fabs(slot.window[i] - med);
+    float mad = median(work, slot.windowLen);
+
+    float limit = TEMP_MAD_K * 1.4826f * mad;
+    if (limit < TEMP_OUTLIER_FLOOR) limit = TEMP_OUTLIER_FLOOR;
+    if (fabs(t - med) > limit) {
+      slot.result = {false, 0.0f, t, "outlier"};
+      return;
     }
+  }
+
+  float prevEma = slot.ema;
+  slot.ema = slot.emaValid ? TEMP_EMA_ALPHA * t + (1.0f - TEMP_EMA_ALPHA) * slot.ema : t;
+
+  unsigned long nowMs = millis();
+  if (slot.emaValid && nowMs > slot.lastAcceptMs) {
+    float minutes = (nowMs - slot.lastAcceptMs) / 60000.0f;
+    float rate = fabs(slot.ema - prevEma) / minutes;
+    slot.ratePerMin = 0.5f * rate + 0.5f * slot.ratePerMin;
+  }
+  slot.lastAcceptMs = nowMs;
+  slot.emaValid = true;
+  slot.result = {true, slot.ema, t, nullptr};
+}
 
-    if (maxDiff <= TEMP_MAX_DIFF) {
-      result.ok = true;
-      result.temp = avg;
-      result.lastFailReason = lastReason; // null on first-try success, set on retry-success
-      return result;
+void TemperatureManager::updateCadence(float distance, unsigned long maxIntervalMs) {
+  float rate = slots[0].ratePerMin;
+  bool urgent = distance <= TEMP_ADAPTIVE_MARGIN || rate >= TEMP_ADAPTIVE_FAST_RATE;
+
+  unsigned long target = maxIntervalMs;
+  if (urgent) {
+    target = TEMP_ADAPTIVE_MIN_INTERVAL;
+  } else if (rate > 0.001f) {
+    // Sample at least twice before the current trend could reach the margin
+    float msToMargin = (distance - TEMP_ADAPTIVE_MARGIN) / rate * 60000.0f;
+    if (msToMargin / 2 < target) target = (unsigned long)(msToMargin / 2);
+  }
+  if (target < TEMP_ADAPTIVE_MIN_INTERVAL) target = TEMP_ADAPTIVE_MIN_INTERVAL;
+  if (target > maxIntervalMs) target = maxIntervalMs;
+
+  // Speed up immediately, back off gradually
+  if (target < sampleInterval) {
+    sampleInterval = target;
+  } else {
+    sampleInterval = (sampleInterval * 2 < target) ? sampleInterval * 2 : target;
+  }
+
+  // Raise resolution at once when precision matters; lower it only well
+  // away from every threshold and after TEMP_RESOLUTION_HOLD, since the
+  // library persists each change to the sensor's EEPROM.
+  uint8_t wanted = resolution;
+  if (urgent || distance <= TEMP_ADAPTIVE_MARGIN * 4) wanted = 12;
+  else if (distance > TEMP_ADAPTIVE_MARGIN * 8) wanted = 10;
+
+  bool allowed = wanted > resolution || millis() - lastResolutionChange >= TEMP_RESOLUTION_HOLD;
+  if (wanted != resolution && allowed && readState == READ_IDLE) {
+    sensors.setResolution(wanted);
+    resolution = wanted;
+    lastResolutionChange = millis();
+    logger.addLog("DS18B20 resolution -> " + String(wanted) + " bit");
+  }
+}
+
+float TemperatureManager::getRateOfChange(uint8_t sensorId) const {
+  if (sensorId < sensorCount) return slots[sensorId].ratePerMin;
+  return 0.0f;
+}
+
+// Median by insertion sort; n is at most TEMP_FILTER_WINDOW. Sorts in place.
+float TemperatureManager::median(float* values, uint8_t n) {
+  for (uint8_t i = 1; i < n; i++) {
+    float v = values[i];
+    int8_t j = i - 1;
+    while (j >= 0 && values[j] > v) {
+      values[j + 1] = values[j];
+      j--;
     }
+    values[j + 1] = v;
+  }
+  return (n & 1) ? values[n / 2] : 0.5f * (values[n / 2 - 1] + values[n / 2]);
+}
+
+const TempReadResult& TemperatureManager::getReadResult(uint8_t sensorId) const {
+  if (sensorId < sensorCount) return slots[sensorId].result;
+  return slots[0].result;
+}
 
-    lastReason = "inconsistent";
-    delay(TEMP_RETRY_DELAY);
+String TemperatureManager::getSensorAddress(uint8_t sensorId) const {
+  if (sensorId >= sensorCount) return "";
+  char buf[17];
+  for (uint8_t i = 0; i < 8; i++) {
+    snprintf(buf + i * 2, 3, "%02X", slots[sensorId].addr[i]);
   }
+  return String(buf);
+}
+
+float TemperatureManager::getCurrentTemp(uint8_t sensorId) const {
+  if (sensorId < sensorCount) return slots[sensorId].currentTemp;
+  return slots[0].currentTemp;
+}
 
-  // Both attempts failed
-  result.lastFailReason = lastReason ? lastReason : "unknown";
-  return result;
+void TemperatureManager::setCurrentTemp(float temp, uint8_t sensorId) {
+  if (sensorId < sensorCount) slots[sensorId].currentTemp = temp;
 }
 
 void TemperatureManager::logTemperature(float temp, int sensorID) {
@@ -91,19 +264,42 @@ void TemperatureManager::logTemperature(float temp, int sensorID) {
     }
   }
 
-  File logFile = LittleFS.open(LOG_FILE, "a");
-  if (logFile) {
-    logFile.printf("%lu,%.2f,%d\n", timestamp, temp, sensorID);
-    logFile.close();
-  } else {
-    static bool fileError = false;
-    if (!fileError) {
-      logger.addLog("ERROR: Cannot open log file");
-      fileError = true;
+  TempRecord rec;
+  rec.timestamp = timestamp;
+  rec.centiC = TimeSeriesStore::toCenti(temp);
+  rec.sensorId = (uint8_t)sensorID;
+  rec.reserved = 0;
+
+  logStore.append(&rec);
+
+  if (now >= 1000000000) {
+    for (int t = 0; t < ROLLUP_COUNT; t++) {
+      rollups[t].add(rec.timestamp, rec.centiC, rec.sensorId);
     }
   }
 }
 
+void TemperatureManager::flushLog() {
+  logStore.flush();
+  for (int t = 0; t < ROLLUP_COUNT; t++) {
+    rollups[t].flush();
+  }
+}
+
+void TemperatureManager::flushLogIfDue() {
+  logStore.flushIfDue();
+  for (int t = 0; t < ROLLUP_COUNT; t++) {
+    rollups[t].flushIfDue();
+  }
+}
+
+void TemperatureManager::clearLog() {
+  logStore.clear();
+  for (int t = 0; t < ROLLUP_COUNT; t++) {
+    rollups[t].clear();
+  }
+}
+
 // Temperature conversion helpers
 float TemperatureManager::celsiusToFahrenheit(float c) {
   return (c * 9.0 / 5.0) + 32.0;
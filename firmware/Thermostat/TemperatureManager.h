@@ -8,13 +8,15 @@
 #include <time.h>
 #include "Config.h"
 #include "SystemLogger.h"
+#include "TimeSeriesStore.h"
+#include "RollupTier.h"
 
 struct TempReadResult {
-  bool ok;                     // true on successful read (possibly after retry)
-  float temp;                  // valid only when ok
-  uint8_t attemptsTaken;       // 1 if first try succeeded, 2 if a retry happened
-  const char* lastFailReason;  // nullptr if no attempt failed; otherwise
-                               // "disconnect", "out-of-range", or "inconsistent"
+  bool ok;                     // true if the sample passed the filter
+  float temp;                  // smoothed value, valid only when ok
+  float raw;                   // the sample itself (0 on "disconnect")
+  const char* lastFailReason;  // nullptr when ok; otherwise
+                               // "disconnect", "out-of-range", or "outlier"
 };
 
 class TemperatureManager {
@@ -22,11 +24,56 @@ public:
   TemperatureManager();
 
   void begin();
+
+  // Blocking read — only used from setup() before the web server is up.
+  // Reads every sensor; returns sensor 0's result.
   TempReadResult readTemperatureWithValidation();
+
+  // Non-blocking read: startRead() kicks off one global conversion for the
+  // whole bus and pollRead() is called on every loop() pass. It returns true
+  // exactly once per read, after which getReadResult(i) holds the filtered
+  // result for each sensor. Between those calls the bus is left converting
+  // and loop() keeps serving the web server and OTA.
+  //
+  // Each conversion contributes one sample per sensor. A sample is gated
+  // against the median of the sensor's last TEMP_FILTER_WINDOW samples
+  // (Hampel filter: reject if further than TEMP_MAD_K scaled MADs away) and
+  // accepted samples feed an EMA. An outlier is simply dropped — no retry —
+  // and a genuine step change passes once it holds the window majority.
+  bool startRead();
+  bool pollRead();
+  bool isReading() const { return readState != READ_IDLE; }
+  const TempReadResult& getReadResult(uint8_t sensorId) const;
+
+  // Adaptive cadence, driven by the primary sensor. Called after each of
+  // its accepted reads with the distance to the nearest active relay
+  // threshold and the user's update frequency (the slowest allowed
+  // cadence). Speeds up at once when near a threshold or changing fast,
+  // backs off by doubling when stable, and picks the DS18B20 resolution:
+  // 12 bit (750 ms) near a threshold, 10 bit (188 ms) when far and flat.
+  void updateCadence(float thresholdDistance, unsigned long maxIntervalMs);
+  unsigned long getSampleInterval() const { return sampleInterval; }
+  float getRateOfChange(uint8_t sensorId = 0) const;  // °C/min, smoothed
+  uint8_t getResolution() const { return resolution; }
+
+  // Each reading goes to the raw store and, once NTP has synced, to the
+  // 1-min / 15-min / hourly rollup tiers. All stores stage in RAM; loop()
+  // calls flushLogIfDue() and restart / OTA paths call flushLog().
   void logTemperature(float temp, int sensorID);
+  void flushLog();
+  void flushLogIfDue();
+  void clearLog();
+
+  enum RollupIndex { ROLLUP_1M = 0, ROLLUP_15M = 1, ROLLUP_1H = 2, ROLLUP_COUNT = 3 };
+  const TimeSeriesStore& getLogStore() const { return logStore; }
+  const RollupTier& getRollup(RollupIndex tier) const { return rollups[tier]; }
 
-  float getCurrentTemp() const { return currentTemp; }
-  void setCurrentTemp(float temp) { currentTemp = temp; }
+  // Sensor ids are indices into the ROM table discovered at begin().
+  // Sensor 0 is the primary probe used for relay control.
+  uint8_t getSensorCount() const { return sensorCount; }
+  String getSensorAddress(uint8_t sensorId) const;
+  float getCurrentTemp(uint8_t sensorId = 0) const;
+  void setCurrentTemp(float temp, uint8_t sensorId = 0);
 
   // Temperature conversion helpers
   static float celsiusToFahrenheit(float c);
@@ -35,9 +82,44 @@ public:
   static String getTempUnit(bool useFahrenheit);
 
 private:
+  enum ReadState { READ_IDLE, READ_CONVERTING };
+
+  struct SensorSlot {
+    DeviceAddress addr;
+    float currentTemp;
+    float window[TEMP_FILTER_WINDOW];  // ring of recent in-range samples
+    uint8_t windowLen;
+    uint8_t windowPos;
+    float ema;
+    bool emaValid;
+    unsigned long lastAcceptMs;      // for the rate-of-change estimate
+    float ratePerMin;                // smoothed |d temp / dt|, °C/min
+    TempReadResult result;
+  };
+
   OneWire oneWire;
   DallasTemperature sensors;
-  float currentTemp;
+  TimeSeriesStore logStore;
+  RollupTier rollups[ROLLUP_COUNT];
+  SensorSlot slots[MAX_TEMP_SENSORS];
+  uint8_t sensorCount;          // always >= 1; slot 0 is a placeholder if the bus is empty
+  bool discovered;              // true once at least one ROM has been cached
+  unsigned long lastDiscovery;  // millis() of the last bus search
+  bool missingLogged;           // "no sensors" warned about since the bus went empty
+
+  // Async read state
+  ReadState readState;
+  unsigned long conversionStart;    // millis() when Convert T was issued
+  unsigned long conversionTime;     // ms the DS18B20 needs at this resolution
+
+  // Adaptive cadence state
+  unsigned long sampleInterval;     // ms between reads
+  uint8_t resolution;               // bits, 9..12
+  unsigned long lastResolutionChange;
+
+  void discoverSensors();
+  void filterSample(SensorSlot& slot, float t);
+  static float median(float* values, uint8_t n);
 };
 
 #endif // TEMPERATURE_MANAGER_H
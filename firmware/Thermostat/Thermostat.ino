@@ -7,6 +7,7 @@
 #include "TemperatureManager.h"
 #include "RelayController.h"
 #include "ConfigManager.h"
+#include "ScheduleManager.h"
 #include "WebInterface.h"
 #include "ApiClient.h"
 
@@ -16,22 +17,45 @@ bool useFahrenheit = false;
 unsigned long lastTempUpdate = 0;
 unsigned long lastHeartbeat = 0;
 unsigned long lastCommandPoll = 0;
+bool restartPending = false;
+unsigned long restartRequestedAt = 0;
 
 // ---- Module Instances ----
 TemperatureManager tempManager;
-RelayController relayController;
+Relays relayController(RELAY_PINS);
 ConfigManager configManager(relayController);
+ScheduleManager scheduleManager(relayController);
 ApiClient apiClient(API_URL);
-WebInterface webInterface(tempManager, relayController, configManager, apiClient, updateFrequency, useFahrenheit);
+WebInterface webInterface(tempManager, relayController, configManager, scheduleManager, apiClient, updateFrequency,
+                          useFahrenheit);
+
+// Relay switches for the system log; deferrals are logged by the controller
+// itself since only it knows how long they wait.
+static void logRelayEvent(const RelayEvent& e) {
+  if (!(e.changes & RELAY_CHANGED_STATE)) return;
+  String msg = "Relay " + String(e.index + 1) + " -> " + (e.state ? "ON" : "OFF");
+  if (e.mode == PID) msg += " (PID " + String((int)(relayController.getPidOutput(e.index) * 100 + 0.5f)) + "%)";
+  else msg += " @ " + String(tempManager.getCurrentTemp(), 1) + "C";
+  logger.addLog(msg);
+}
 
 void setup() {
   Serial.begin(115200);
   delay(500);
-  Serial.println("\n\n=== DEBUG1 - 4 Relay Test ===");
+  Serial.println("\n\n=== DEBUG1 - " + String(RELAY_COUNT) + " Relay Test ===");
 
   // Initialize filesystem and load configuration
   configManager.begin();
   configManager.loadSettings(updateFrequency, useFahrenheit);
+  scheduleManager.begin();
+  apiClient.begin();  // opens the outbox, so before anything is queued
+  apiClient.setConfigVersion(configManager.getConfigVersion());
+
+  // Everything that reacts to relay changes hears about them from the
+  // controller. Subscribed after loading so the load itself isn't re-saved.
+  relayController.subscribe([](const RelayEvent& e) { apiClient.onRelayEvent(e, relayController); });
+  relayController.subscribe([](const RelayEvent& e) { configManager.onRelayEvent(e); });
+  relayController.subscribe(logRelayEvent);
 
   // Initialize relay controller
   relayController.begin();
@@ -59,6 +83,8 @@ void setup() {
   // Setup OTA
   ArduinoOTA.setHostname(OTA_HOSTNAME);
   ArduinoOTA.onStart([]() {
+    tempManager.flushLog();
+    apiClient.flushOutbox();
     logger.addLog("OTA Update Starting...");
   });
   ArduinoOTA.onEnd([]() {
@@ -74,23 +100,28 @@ void setup() {
   logger.addLog("OTA ready");
 
   // Setup NTP time sync
-  configTime(0, 0, "pool.ntp.org", "time.nist.gov");
+  // TIMEZONE only affects localtime() (the weekly schedule); all stored
+  // timestamps stay UTC epoch seconds.
+  configTime(TIMEZONE, "pool.ntp.org", "time.nist.gov");
   logger.addLog("NTP time sync started");
 
   // Get initial temperature and apply relay logic BEFORE the web server
   // starts so /status returns sensible values immediately.
-  TempReadResult initial = tempManager.readTemperatureWithValidation();
-  if (initial.ok) {
-    tempManager.setCurrentTemp(initial.temp);
-    logger.addLog("Initial temp: " + String(initial.temp, 1) + "C");
-  } else {
-    tempManager.setCurrentTemp(20.0); // Safe default if sensor not working
-    logger.addLog("WARN: Initial sensor read failed (" + String(initial.lastFailReason) + "), using default 20.0C");
+  tempManager.readTemperatureWithValidation();
+  for (uint8_t s = 0; s < tempManager.getSensorCount(); s++) {
+    const TempReadResult& initial = tempManager.getReadResult(s);
+    if (initial.ok) {
+      tempManager.setCurrentTemp(initial.temp, s);
+      logger.addLog("Initial temp S" + String(s) + ": " + String(initial.temp, 1) + "C");
+    } else {
+      tempManager.setCurrentTemp(20.0, s); // Safe default if sensor not working
+      logger.addLog("WARN: Initial read of S" + String(s) + " failed (" + String(initial.lastFailReason) + "), using default 20.0C");
+    }
   }
 
   logger.addLog("Applying relay settings...");
-  for (int i = 0; i < 4; i++) {
-    String msg = "R" + String(i + 1) + ": " + RelayController::modeToString(relayController.getRelayMode(i));
+  for (int i = 0; i < RELAY_COUNT; i++) {
+    String msg = "R" + String(i + 1) + ": " + Relays::modeToString(relayController.getRelayMode(i));
     msg += " (ON=" + String(relayController.getTempOn(i), 1) + "C, OFF=" + String(relayController.getTempOff(i), 1) + "C)";
     logger.addLog(msg);
   }
@@ -98,11 +129,10 @@ void setup() {
 
   // Start the local web server BEFORE talking to the backend so the device is
   // reachable on the LAN even if the backend is slow or down.
-  apiClient.begin();
   webInterface.begin();
 
   // Register with backend (one short blocking call). Even if this fails the
-  // local UI keeps working; the loop will retry sync via dirty flags.
+  // local UI keeps working; queued telemetry goes up once registered.
   if (WiFi.status() == WL_CONNECTED) {
     String hostname = WiFi.getHostname();
     String macAddress = WiFi.macAddress();
@@ -115,10 +145,9 @@ void setup() {
     }
   }
 
-  // Queue initial relay state sync — drained one per loop iteration so we
-  // never block the web server with a startup burst of HTTP calls.
-  for (int i = 0; i < 4; i++) {
-    apiClient.markRelayDirty(i);
+  // Full relay state once per boot; from here on only changes are queued
+  for (int i = 0; i < RELAY_COUNT; i++) {
+    apiClient.queueRelayState(relayController, i);
   }
 
   logger.addLog("=== SETUP COMPLETE ===");
@@ -127,102 +156,85 @@ void setup() {
 
 // Process a single backend command. The caller pops it from the queue after
 // this returns; for the "restart" case we drain the rest of the queue here.
+// Status updates are only queued; loop() sends them. Params were already
+// decoded into cmd when it arrived (see ApiClient::decodeCommand).
 static void processCommand(ApiClient::Command& cmd) {
-  logger.addLog("Processing command: " + cmd.type);
+  logger.addLog(String("Processing command: ") + ApiClient::commandTypeName(cmd.type));
   apiClient.updateCommandStatus(cmd.id, "acknowledged");
 
   bool success = false;
   String result = "";
+  int relayIdx = cmd.relay - 1;
 
-  if (cmd.type == "set_relay_mode") {
-    JsonDocument paramsDoc;
-    DeserializationError error = deserializeJson(paramsDoc, cmd.params);
-    if (!error) {
-      int relayNum = paramsDoc["relay_number"];
-      String mode = paramsDoc["mode"].as<String>();
-      if (relayNum >= 1 && relayNum <= 4) {
-        Mode newMode = Mode::AUTO;
-        if (mode == "MANUAL_ON") newMode = Mode::MANUAL_ON;
-        else if (mode == "MANUAL_OFF") newMode = Mode::MANUAL_OFF;
-        relayController.setRelayMode(relayNum - 1, newMode);
-        relayController.applyRelayLogic(tempManager.getCurrentTemp());
-        configManager.saveSettings(updateFrequency, useFahrenheit);
-        apiClient.markRelayDirty(relayNum - 1);
-        success = true;
-        result = "Relay " + String(relayNum) + " mode set to " + mode;
-        logger.addLog(result);
-      }
+  if (!cmd.isValid) {
+    logger.addLog("Command " + String(cmd.id) + ": unknown type or bad params");
+  }
+  else if (cmd.type == ApiClient::CMD_SET_RELAY_MODE) {
+    if (Relays::isValidIndex(relayIdx)) {
+      relayController.setRelayMode(relayIdx, cmd.mode);
+      relayController.applyRelayLogic(tempManager.getCurrentTemp());
+      success = true;
+      result = "Relay " + String(cmd.relay) + " mode set to " + Relays::modeToString(cmd.mode);
+      logger.addLog(result);
     }
   }
-  else if (cmd.type == "set_thresholds") {
-    JsonDocument paramsDoc;
-    DeserializationError error = deserializeJson(paramsDoc, cmd.params);
-    if (!error) {
-      int relayNum = paramsDoc["relay_number"];
-      float tempOn = paramsDoc["temp_on"];
-      float tempOff = paramsDoc["temp_off"];
-      if (relayNum >= 1 && relayNum <= 4) {
-        relayController.setTempThresholds(relayNum - 1, tempOn, tempOff);
-        relayController.applyRelayLogic(tempManager.getCurrentTemp());
-        configManager.saveSettings(updateFrequency, useFahrenheit);
-        apiClient.markRelayDirty(relayNum - 1);
-        success = true;
-        result = "Relay " + String(relayNum) + " thresholds updated";
-        logger.addLog(result);
-      }
+  else if (cmd.type == ApiClient::CMD_SET_THRESHOLDS) {
+    if (Relays::isValidIndex(relayIdx)) {
+      relayController.setTempThresholds(relayIdx, cmd.thresholds.on, cmd.thresholds.off);
+      relayController.applyRelayLogic(tempManager.getCurrentTemp());
+      success = true;
+      result = "Relay " + String(cmd.relay) + " thresholds updated";
+      logger.addLog(result);
     }
   }
-  else if (cmd.type == "set_relay_type") {
-    JsonDocument paramsDoc;
-    DeserializationError error = deserializeJson(paramsDoc, cmd.params);
-    if (!error) {
-      int relayNum = paramsDoc["relay_number"];
-      String type = paramsDoc["relay_type"].as<String>();
-      if (relayNum >= 1 && relayNum <= 4) {
-        RelayType newType = RelayType::HEATING;
-        if (type == "COOLING") newType = RelayType::COOLING;
-        else if (type == "GENERIC") newType = RelayType::GENERIC;
-        else if (type == "MANUAL_ONLY") newType = RelayType::MANUAL_ONLY;
-        relayController.setRelayType(relayNum - 1, newType);
-        relayController.applyRelayLogic(tempManager.getCurrentTemp());
-        configManager.saveSettings(updateFrequency, useFahrenheit);
-        apiClient.markRelayDirty(relayNum - 1);
-        success = true;
-        result = "Relay " + String(relayNum) + " type set to " + type;
-        logger.addLog(result);
-      }
+  else if (cmd.type == ApiClient::CMD_SET_PID) {
+    if (Relays::isValidIndex(relayIdx)) {
+      PidSettings pid = relayController.getPidSettings(relayIdx);
+      if (!isnan(cmd.pid.kp)) pid.kp = cmd.pid.kp;
+      if (!isnan(cmd.pid.ki)) pid.ki = cmd.pid.ki;
+      if (!isnan(cmd.pid.kd)) pid.kd = cmd.pid.kd;
+      if (cmd.pid.window > 0) pid.windowSec = cmd.pid.window;
+      relayController.setPidSettings(relayIdx, pid);
+      success = true;
+      result = "Relay " + String(cmd.relay) + " PID settings updated";
+      logger.addLog(result);
     }
   }
-  else if (cmd.type == "set_frequency") {
-    JsonDocument paramsDoc;
-    DeserializationError error = deserializeJson(paramsDoc, cmd.params);
-    if (!error) {
-      int freq = paramsDoc["frequency"];
-      if (freq >= 1 && freq <= 60) {
-        updateFrequency = freq;
-        configManager.saveSettings(updateFrequency, useFahrenheit);
-        success = true;
-        result = "Update frequency set to " + String(freq) + "s";
-        logger.addLog(result);
-      }
+  else if (cmd.type == ApiClient::CMD_SET_SCHEDULE) {
+    String scheduleError;
+    success = scheduleManager.setEntries(apiClient.getScheduleEntries(), cmd.scheduleCount, scheduleError);
+    result = success ? "Schedule updated" : "Schedule rejected: " + scheduleError;
+    logger.addLog(result);
+  }
+  else if (cmd.type == ApiClient::CMD_SET_RELAY_TYPE) {
+    if (Relays::isValidIndex(relayIdx)) {
+      relayController.setRelayType(relayIdx, cmd.relayType);
+      relayController.applyRelayLogic(tempManager.getCurrentTemp());
+      success = true;
+      result = "Relay " + String(cmd.relay) + " type set to " + Relays::typeToString(cmd.relayType);
+      logger.addLog(result);
     }
   }
-  else if (cmd.type == "set_unit") {
-    JsonDocument paramsDoc;
-    DeserializationError error = deserializeJson(paramsDoc, cmd.params);
-    if (!error) {
-      bool useFahr = paramsDoc["use_fahrenheit"];
-      useFahrenheit = useFahr;
+  else if (cmd.type == ApiClient::CMD_SET_FREQUENCY) {
+    if (cmd.frequency >= 1 && cmd.frequency <= 60) {
+      updateFrequency = cmd.frequency;
       configManager.saveSettings(updateFrequency, useFahrenheit);
       success = true;
-      result = "Temperature unit set to " + String(useFahr ? "Fahrenheit" : "Celsius");
+      result = "Update frequency set to " + String(cmd.frequency) + "s";
       logger.addLog(result);
     }
   }
-  else if (cmd.type == "restart") {
+  else if (cmd.type == ApiClient::CMD_SET_UNIT) {
+    useFahrenheit = cmd.useFahrenheit;
+    configManager.saveSettings(updateFrequency, useFahrenheit);
+    success = true;
+    result = "Temperature unit set to " + String(cmd.useFahrenheit ? "Fahrenheit" : "Celsius");
+    logger.addLog(result);
+  }
+  else if (cmd.type == ApiClient::CMD_RESTART) {
     result = "Restarting device...";
     logger.addLog(result);
-    apiClient.updateCommandStatus(cmd.id, "completed", result);
+    apiClient.updateCommandStatus(cmd.id, "completed", result.c_str());
     // Mark any remaining queued commands as failed so the server doesn't think
     // they're still being executed across the reboot.
     apiClient.popNextCommand();
@@ -231,18 +243,71 @@ static void processCommand(ApiClient::Command& cmd) {
       if (next) apiClient.updateCommandStatus(next->id, "failed", "Device restarting");
       apiClient.popNextCommand();
     }
-    delay(1000);
-    ESP.restart();
-    return; // not reached
+    // loop() restarts once those statuses are sent
+    restartPending = true;
+    restartRequestedAt = millis();
+    return;
   }
 
   if (success) {
-    apiClient.updateCommandStatus(cmd.id, "completed", result);
+    apiClient.updateCommandStatus(cmd.id, "completed", result.c_str());
   } else {
     apiClient.updateCommandStatus(cmd.id, "failed", "Command execution failed");
   }
 }
 
+// Apply one sensor's completed read: log it, queue the upload and, for the
+// primary sensor, drive the relays.
+static void handleTempReading(uint8_t sensorId, const TempReadResult& r) {
+  static int consecutiveSensorFails[MAX_TEMP_SENSORS] = {0};
+
+  if (r.ok) {
+    // End-of-streak summary so flaky-bus events are visible without
+    // logging every single dropped sample.
+    if (consecutiveSensorFails[sensorId] > 0) {
+      logger.addLog("Sensor " + String(sensorId) + " recovered after " + String(consecutiveSensorFails[sensorId]) + " dropped sample(s)");
+      consecutiveSensorFails[sensorId] = 0;
+    }
+
+    tempManager.setCurrentTemp(r.temp, sensorId);
+    Serial.print("Temp S");
+    Serial.print(sensorId);
+    Serial.print(": ");
+    Serial.print(r.temp, 1);
+    Serial.print("C");
+
+    if (sensorId == 0) {
+      Serial.print(" | Relays: ");
+
+      relayController.applyRelayLogic(r.temp);
+      tempManager.updateCadence(relayController.getThresholdDistance(r.temp),
+                                (unsigned long)updateFrequency * 1000);
+
+      for (int i = 0; i < RELAY_COUNT; i++) {
+        Serial.print(i + 1);
+        Serial.print(":");
+        Serial.print(relayController.getRelayState(i) ? "ON" : "OFF");
+        Serial.print("(");
+        Serial.print(Relays::modeToString(relayController.getRelayMode(i)));
+        Serial.print(") ");
+      }
+    }
+    Serial.println();
+
+    tempManager.logTemperature(r.temp, sensorId);
+    apiClient.queueReading(r.temp, sensorId);
+  } else {
+    consecutiveSensorFails[sensorId]++;
+    String msg = "Sensor " + String(sensorId) + " sample dropped (" + (r.lastFailReason ? r.lastFailReason : "unknown");
+    if (r.lastFailReason && strcmp(r.lastFailReason, "disconnect") != 0) msg += " " + String(r.raw, 2) + "C";
+    msg += "), kept last " + String(tempManager.getCurrentTemp(sensorId), 1) + "C";
+    if (consecutiveSensorFails[sensorId] > 1) {
+      msg += " [" + String(consecutiveSensorFails[sensorId]) + " consecutive]";
+    }
+    logger.addLog(msg);
+  }
+}
+
 void loop() {
   ArduinoOTA.handle();
   webInterface.handleClient();
@@ -258,103 +323,93 @@ void loop() {
   }
 
   // ---- Periodic temperature read ----
-  if (now - lastTempUpdate >= (unsigned long)updateFrequency * 1000) {
+  // Only the conversion is started here; the filtered result arrives on a
+  // later pass via pollRead() so the DS18B20 conversion time never blocks
+  // the web server or OTA. The interval adapts (see updateCadence) but never
+  // exceeds the user's update frequency.
+  unsigned long sampleInterval = tempManager.getSampleInterval();
+  if (sampleInterval > (unsigned long)updateFrequency * 1000) sampleInterval = (unsigned long)updateFrequency * 1000;
+  if (!tempManager.isReading() && now - lastTempUpdate >= sampleInterval) {
     lastTempUpdate = now;
+    tempManager.startRead();
+  }
 
-    static int consecutiveSensorFails = 0;
-    TempReadResult r = tempManager.readTemperatureWithValidation();
+  if (tempManager.pollRead()) {
+    for (uint8_t s = 0; s < tempManager.getSensorCount(); s++) {
+      handleTempReading(s, tempManager.getReadResult(s));
+    }
+  }
+  tempManager.flushLogIfDue();
+  apiClient.flushOutboxIfDue();
 
-    if (r.ok) {
-      // Surface a retry-recovery so the user can see flaky-bus events without
-      // having to read between successful reads.
-      if (r.attemptsTaken > 1 && r.lastFailReason) {
-        logger.addLog(String("Sensor recovered after retry (") + r.lastFailReason + ")");
-      }
-      // End-of-streak summary: only log if we'd been actually failing (>=1
-      // both-attempts-failed event), not just retrying.
-      if (consecutiveSensorFails > 0) {
-        logger.addLog("Sensor recovered after " + String(consecutiveSensorFails) + " failed read(s)");
-        consecutiveSensorFails = 0;
-      }
+  // ---- Weekly schedule, PID windows and deferred (short-cycle) transitions ----
+  if (scheduleManager.tick()) {
+    relayController.applyRelayLogic(tempManager.getCurrentTemp());
+  }
+  relayController.update();
 
-      tempManager.setCurrentTemp(r.temp);
-      Serial.print("Temp: ");
-      Serial.print(r.temp, 1);
-      Serial.print("C | Relays: ");
+  // Relay setting changes from the web UI or backend commands land here
+  configManager.saveIfDirty(updateFrequency, useFahrenheit);
 
-      bool previousStates[4];
-      for (int i = 0; i < 4; i++) previousStates[i] = relayController.getRelayState(i);
+  // ---- Backend sync ----
+  // Requests in flight (if any) move a step forward each pass; nothing
+  // here waits on the network.
+  apiClient.poll();
 
-      relayController.applyRelayLogic(r.temp);
+  if (restartPending && ((!apiClient.isBusy() && !apiClient.hasStatusUpdates())
+                         || now - restartRequestedAt >= RESTART_GRACE_PERIOD)) {
+    tempManager.flushLog();
+    apiClient.flushOutbox();
+    ESP.restart();
+  }
 
-      for (int i = 0; i < 4; i++) {
-        Serial.print(i + 1);
-        Serial.print(":");
-        Serial.print(relayController.getRelayState(i) ? "ON" : "OFF");
-        Serial.print("(");
-        Serial.print(RelayController::modeToString(relayController.getRelayMode(i)));
-        Serial.print(") ");
-        if (relayController.getRelayState(i) != previousStates[i]) {
-          apiClient.markRelayDirty(i);
-        }
-      }
-      Serial.println();
+  // Settings changed on the dashboard, delivered with any sync response
+  ApiClient::DesiredConfig desired;
+  if (apiClient.takeConfigUpdate(desired)) {
+    if (desired.updateFrequency >= 1 && desired.updateFrequency <= 60) updateFrequency = desired.updateFrequency;
+    useFahrenheit = desired.useFahrenheit;
+    configManager.setConfigVersion(desired.version);
+    configManager.saveSettings(updateFrequency, useFahrenheit);
+    logger.addLog("Backend config v" + String(desired.version) + ": " + String(updateFrequency) + "s, "
+                  + (useFahrenheit ? "Fahrenheit" : "Celsius"));
+  }
 
-      tempManager.logTemperature(r.temp, 0);
-      apiClient.markTempDirty();
-    } else {
-      consecutiveSensorFails++;
-      String msg = String("Sensor read failed (") + (r.lastFailReason ? r.lastFailReason : "unknown")
-                 + "), kept last " + String(tempManager.getCurrentTemp(), 1) + "C";
-      if (consecutiveSensorFails > 1) {
-        msg += " [" + String(consecutiveSensorFails) + " consecutive]";
-      }
-      logger.addLog(msg);
+  // One received command per pass; it only queues its status updates
+  if (!restartPending && apiClient.hasPendingCommands()) {
+    ApiClient::Command* cmd = apiClient.peekNextCommand();
+    if (cmd) {
+      processCommand(*cmd);
+      apiClient.popNextCommand();
     }
   }
 
-  // ---- Drain pending API work, AT MOST ONE blocking call per loop iteration ----
-  // Order: temperature first (most time-sensitive), then any one dirty relay,
-  // then heartbeat, then a single pending command. The web server gets a turn
-  // between each one.
-  if (apiClient.isRegistered() && WiFi.status() == WL_CONNECTED) {
-    if (apiClient.isTempDirty()) {
-      if (apiClient.sendTemperatureReading(tempManager.getCurrentTemp(), 0)) {
-        apiClient.clearTempDirty();
-      }
-    } else {
-      int dirtyRelay = apiClient.nextDirtyRelay();
-      if (dirtyRelay >= 0) {
-        bool  state   = relayController.getRelayState(dirtyRelay);
-        String mode   = RelayController::modeToString(relayController.getRelayMode(dirtyRelay));
-        float tempOn  = relayController.getTempOn(dirtyRelay);
-        float tempOff = relayController.getTempOff(dirtyRelay);
-
-        // Skip the network round trip if the backend already has this exact
-        // state — covers boot-time blast, no-op web clicks, and command
-        // handlers that re-mark dirty without actually changing anything.
-        if (apiClient.relayStateMatchesLastSent(dirtyRelay, state, mode, tempOn, tempOff)) {
-          apiClient.clearRelayDirty(dirtyRelay);
-        } else if (apiClient.sendRelayState(
-              dirtyRelay + 1, state, mode, tempOn, tempOff,
-              "Relay " + String(dirtyRelay + 1))) {
-          apiClient.recordRelaySent(dirtyRelay, state, mode, tempOn, tempOff);
-          apiClient.clearRelayDirty(dirtyRelay);
-        }
-        // If the send failed, leave dirty=true so the next loop iteration retries.
-      } else if (now - lastHeartbeat >= API_HEARTBEAT_INTERVAL) {
-        lastHeartbeat = now;
-        apiClient.sendHeartbeat();
-      } else if (apiClient.hasPendingCommands()) {
-        ApiClient::Command* cmd = apiClient.peekNextCommand();
-        if (cmd) {
-          processCommand(*cmd);
-          apiClient.popNextCommand();
-        }
-      } else if (now - lastCommandPoll >= API_COMMAND_POLL_INTERVAL) {
-        lastCommandPoll = now;
-        apiClient.pollCommands();
-      }
+  // Keep one command long poll outstanding on its own connection; commands
+  // arrive within a second of being created. Sync responses carry pending
+  // commands too, so they still get through while the poll is backing off.
+  if (apiClient.isRegistered() && WiFi.status() == WL_CONNECTED && !restartPending
+      && !apiClient.isPollingCommands() && !apiClient.hasPendingCommands()
+      && now - lastCommandPoll >= API_COMMAND_REPOLL_DELAY && apiClient.endpointReady(API_COMMANDS, now)) {
+    lastCommandPoll = now;
+    apiClient.pollCommands();
+  }
+
+  // Next request once the previous one has completed. Order: command status
+  // updates, then a batch of readings, then a batch of relay states (each
+  // only once due, see ApiClient), then heartbeat. A failed request is
+  // retried once its endpoint's backoff has run out (see CircuitBreaker);
+  // until then the others still get their turn.
+  if (apiClient.isRegistered() && WiFi.status() == WL_CONNECTED && !apiClient.isBusy()) {
+    if (apiClient.hasStatusUpdates() && apiClient.endpointReady(API_COMMAND_STATUS, now)) {
+      apiClient.sendStatusUpdate();
+    } else if (restartPending) {
+      // nothing else before the restart
+    } else if (apiClient.readingsDue(now)) {
+      apiClient.flushReadings();
+    } else if (apiClient.relayStatesDue(now)) {
+      apiClient.flushRelayStates();
+    } else if (now - lastHeartbeat >= API_HEARTBEAT_INTERVAL && apiClient.endpointReady(API_HEARTBEAT, now)) {
+      lastHeartbeat = now;
+      apiClient.sendHeartbeat();
     }
   }
 
@@ -362,7 +417,9 @@ void loop() {
   static unsigned long lastHeapLog = 0;
   if (now - lastHeapLog >= HEAP_LOG_INTERVAL) {
     lastHeapLog = now;
-    logger.addLog("Heap: " + String(ESP.getFreeHeap()) + "B free, frag " + String(ESP.getHeapFragmentation()) + "%");
+    logger.addLog("Heap: " + String(ESP.getFreeHeap()) + "B free, frag " + String(ESP.getHeapFragmentation())
+                  + "%, API arena peak " + String(apiClient.getDocPeak()) + "/" + String(API_DOC_ARENA)
+                  + "B, I/O peak " + String(apiClient.getIoPeak()) + "/" + String(API_IO_BUFFER) + "B");
   }
 
   delay(10);
@@ -0,0 +1,249 @@
+#include "TimeSeriesStore.h"
+
+TimeSeriesStore::TimeSeriesStore(const char* path, uint16_t recordSize, uint32_t capacity,
+                                 unsigned long flushInterval)
+  : path(path), recordSize(recordSize), capacity(capacity), head(0), count(0), nextSeq(0),
+    stagedCount(0), stagedCapacity(TEMP_LOG_STAGING_BYTES / recordSize), firstStagedAt(0),
+    flushInterval(flushInterval), writeErrorLogged(false) {
+}
+
+bool TimeSeriesStore::begin() {
+  File f = LittleFS.open(path, "r");
+  if (f) {
+    Header h;
+    bool valid = f.read((uint8_t*)&h, sizeof(h)) == sizeof(h)
+              && h.magic == MAGIC
+              && h.version == VERSION
+              && h.recordSize == recordSize
+              && h.capacity == capacity
+              && h.head < capacity
+              && h.count <= capacity
+              && f.size() == slotOffset(capacity);
+    f.close();
+    if (valid) {
+      head = h.head;
+      count = h.count;
+      nextSeq = count;
+      logger.addLog(String(path) + ": " + String(count) + "/" + String(capacity) + " records");
+      return true;
+    }
+    logger.addLog(String(path) + " header mismatch, recreating");
+  }
+  return create();
+}
+
+// Allocate the whole file up front so later appends never grow it.
+bool TimeSeriesStore::create() {
+  head = 0;
+  count = 0;
+  nextSeq = 0;
+
+  File f = LittleFS.open(path, "w");
+  if (!f) {
+    logger.addLog("ERROR: Cannot create " + String(path));
+    return false;
+  }
+
+  bool ok = writeHeader(f);
+  uint8_t zeros[256];
+  memset(zeros, 0, sizeof(zeros));
+  size_t remaining = (size_t)capacity * recordSize;
+  while (ok && remaining > 0) {
+    size_t n = remaining < sizeof(zeros) ? remaining : sizeof(zeros);
+    ok = f.write(zeros, n) == n;
+    remaining -= n;
+    yield(); // Feed watchdog
+  }
+  f.close();
+
+  if (!ok) {
+    logger.addLog("ERROR: Preallocating " + String(path) + " failed (flash full?)");
+    LittleFS.remove(path);
+    return false;
+  }
+  logger.addLog("Created " + String(path) + ": " + String(capacity) + " records");
+  return true;
+}
+
+bool TimeSeriesStore::writeHeader(File& f) {
+  Header h = {MAGIC, VERSION, recordSize, capacity, head, count};
+  f.seek(0);
+  return f.write((const uint8_t*)&h, sizeof(h)) == sizeof(h);
+}
+
+void TimeSeriesStore::append(const void* rec) {
+  if (stagedCount == 0) firstStagedAt = millis();
+  memcpy(staged + stagedCount * recordSize, rec, recordSize);
+  stagedCount++;
+  nextSeq++;
+  if (stagedCount >= stagedCapacity) {
+    flush();
+  }
+}
+
+void TimeSeriesStore::flush() {
+  if (stagedCount == 0) return;
+
+  if (!writeBlock(staged, stagedCount) && !writeErrorLogged) {
+    logger.addLog("ERROR: Cannot write " + String(path));
+    writeErrorLogged = true;
+  }
+  // Drop the batch even on failure so a dead filesystem can't wedge logging
+  stagedCount = 0;
+}
+
+void TimeSeriesStore::flushIfDue() {
+  if (stagedCount > 0 && millis() - firstStagedAt >= flushInterval) {
+    flush();
+  }
+}
+
+// Write n records in one pass: at most two contiguous block writes (split at
+// the physical end of the ring) followed by a single header update.
+bool TimeSeriesStore::writeBlock(const uint8_t* recs, size_t n) {
+  File f = LittleFS.open(path, "r+");
+  if (!f) return false;
+
+  bool ok = true;
+  size_t done = 0;
+  uint32_t slot = head;
+  while (ok && done < n) {
+    size_t run = capacity - slot;
+    if (run > n - done) run = n - done;
+    size_t bytes = run * recordSize;
+    ok = f.seek(slotOffset(slot))
+      && f.write(recs + done * recordSize, bytes) == bytes;
+    done += run;
+    slot = 0;
+  }
+
+  if (ok) {
+    head = (head + n) % capacity;
+    count = (count + n > capacity) ? capacity : count + n;
+    // Header goes last: a reset before this point only loses the new batch.
+    ok = writeHeader(f);
+  }
+  f.close();
+  return ok;
+}
+
+void TimeSeriesStore::clear() {
+  stagedCount = 0;
+  head = 0;
+  count = 0;
+  File f = LittleFS.open(path, "r+");
+  if (f) {
+    writeHeader(f);
+    f.close();
+  }
+}
+
+// Staged records are dropped in RAM; flushed ones by moving the oldest mark
+// forward, which costs one header write and no record I/O.
+void TimeSeriesStore::dropOldest(uint32_t n) {
+  uint32_t flushedVisible = size() - stagedCount;
+  uint32_t fromFlash = n < flushedVisible ? n : flushedVisible;
+  uint32_t fromStaged = n - fromFlash < stagedCount ? n - fromFlash : stagedCount;
+
+  if (fromFlash > 0) {
+    // Also forgets the flushed records the staged tail would overwrite
+    count = flushedVisible - fromFlash;
+    File f = LittleFS.open(path, "r+");
+    if (f) {
+      writeHeader(f);
+      f.close();
+    }
+  }
+  if (fromStaged > 0) {
+    memmove(staged, staged + fromStaged * recordSize, (stagedCount - fromStaged) * recordSize);
+    stagedCount -= fromStaged;
+  }
+}
+
+// Records appended or cleared away since seq was taken are already gone;
+// only the rest of the range is dropped.
+void TimeSeriesStore::dropBefore(uint32_t seq) {
+  uint32_t first = firstSeq();
+  if (seq > first) dropOldest(seq - first);
+}
+
+uint32_t TimeSeriesStore::size() const {
+  uint32_t total = count + stagedCount;
+  return total < capacity ? total : capacity;
+}
+
+size_t TimeSeriesStore::read(uint32_t first, void* out, size_t n) const {
+  uint8_t* dst = (uint8_t*)out;
+  // Flushed records that the next flush would overwrite are hidden
+  uint32_t idx = first + (count + stagedCount - size());
+  size_t done = 0;
+
+  if (idx < count) {
+    done = readFlushed(idx, dst, n);
+    idx += done;
+  }
+  while (done < n && idx >= count && idx - count < stagedCount) {
+    memcpy(dst + done * recordSize, staged + (idx - count) * recordSize, recordSize);
+    done++;
+    idx++;
+  }
+  return done;
+}
+
+size_t TimeSeriesStore::readFlushed(uint32_t first, uint8_t* out, size_t n) const {
+  if (first >= count) return 0;
+  if (n > count - first) n = count - first;
+
+  File f = LittleFS.open(path, "r");
+  if (!f) return 0;
+
+  uint32_t oldest = (head + capacity - count) % capacity;
+  uint32_t slot = (oldest + first) % capacity;
+  size_t done = 0;
+  while (done < n) {
+    // Contiguous run up to the physical end of the ring, then wrap to slot 0
+    size_t run = capacity - slot;
+    if (run > n - done) run = n - done;
+    f.seek(slotOffset(slot));
+    size_t bytes = run * recordSize;
+    if (f.read(out + done * recordSize, bytes) != bytes) break;
+    done += run;
+    slot = 0;
+  }
+  f.close();
+  return done;
+}
+
+uint32_t TimeSeriesStore::lowerBound(uint32_t ts) const {
+  File f = LittleFS.open(path, "r");
+  uint32_t lo = 0;
+  uint32_t hi = size();
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    // A boot-relative timestamp says nothing about order: go by the next
+    // wall-clock record instead. If there is none before hi, the answer
+    // is at or before mid.
+    uint32_t j = mid;
+    uint32_t t = timestampAt(f, j);
+    while (t < 1000000000 && ++j < hi) t = timestampAt(f, j);
+    if (j < hi && t < ts) lo = j + 1;
+    else hi = mid;
+  }
+  if (f) f.close();
+  return lo;
+}
+
+// Timestamp of logical record idx (0 = oldest, staged tail included).
+uint32_t TimeSeriesStore::timestampAt(File& f, uint32_t idx) const {
+  uint32_t ts = 0;
+  idx += count + stagedCount - size();
+  if (idx >= count) {
+    memcpy(&ts, staged + (idx - count) * recordSize, sizeof(ts));
+    return ts;
+  }
+  if (!f) return 0;
+  uint32_t oldest = (head + capacity - count) % capacity;
+  f.seek(slotOffset((oldest + idx) % capacity));
+  f.read((uint8_t*)&ts, sizeof(ts));
+  return ts;
+}
@@ -0,0 +1,99 @@
+#ifndef TIME_SERIES_STORE_H
+#define TIME_SERIES_STORE_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "Config.h"
+#include "SystemLogger.h"
+
+// Fixed-size binary temperature record. 8 bytes, so 512 fit in one 4 KB
+// flash block and a record's offset is a multiplication, not a scan.
+struct __attribute__((packed)) TempRecord {
+  uint32_t timestamp;   // unix seconds, or seconds since boot before NTP sync
+  int16_t  centiC;      // temperature in 1/100 °C
+  uint8_t  sensorId;
+  uint8_t  reserved;
+};
+
+// Preallocated ring buffer of fixed-size records on LittleFS. The file is
+// sized once at creation and never grows: appends overwrite the oldest
+// record when full. A small header at offset 0 tracks the write head and
+// count.
+//
+// Appends are staged in RAM and written as one block when the staging
+// buffer fills, when the flush interval passes (flushIfDue), or on an
+// explicit flush() before a restart / OTA. size() and read() include the
+// staged tail, so readers never see the difference.
+class TimeSeriesStore {
+public:
+  TimeSeriesStore(const char* path, uint16_t recordSize, uint32_t capacity,
+                  unsigned long flushInterval = TEMP_LOG_FLUSH_INTERVAL);
+
+  bool begin();                 // LittleFS must already be mounted
+  void append(const void* rec);
+  void flush();
+  void flushIfDue();
+  void clear();
+  void dropOldest(uint32_t n);  // consume from the front
+  void dropBefore(uint32_t seq); // drop what is left of records older than seq
+
+  uint32_t size() const;
+  // Sequence number of logical record 0. Appends since begin() are numbered
+  // from the records already on flash, so the oldest of those is 0; dropping
+  // or overwriting records moves it forward. Lets a caller tell which of the
+  // records it read earlier are still there.
+  uint32_t firstSeq() const { return nextSeq - size(); }
+  uint32_t getCapacity() const { return capacity; }
+
+  // Copy up to n records starting at logical index `first` (0 = oldest)
+  // into out. Returns the number of records read.
+  size_t read(uint32_t first, void* out, size_t n) const;
+
+  // Binary search for the first logical index whose timestamp is >= ts
+  // (every record type stores its uint32 timestamp in the first 4 bytes).
+  // Each reboot logs a run of boot-relative timestamps until NTP syncs, in
+  // the middle of the wall-clock ones; those runs are skipped over, so
+  // every wall-clock record before the result is < ts and every one from
+  // it on is >= ts. O(log n) single-record reads, plus the length of any
+  // pre-sync run the search lands in.
+  uint32_t lowerBound(uint32_t ts) const;
+
+  static int16_t toCenti(float tempC) { return (int16_t)lroundf(tempC * 100.0f); }
+  static float fromCenti(int16_t centiC) { return centiC / 100.0f; }
+
+private:
+  struct __attribute__((packed)) Header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t capacity;
+    uint32_t head;              // slot the next flushed record goes to
+    uint32_t count;             // records on flash; oldest slot is head - count
+  };
+
+  static const uint32_t MAGIC = 0x54535452;  // "TSTR"
+  static const uint16_t VERSION = 1;
+
+  const char* path;
+  uint16_t recordSize;
+  uint32_t capacity;
+  uint32_t head;
+  uint32_t count;
+  uint32_t nextSeq;             // sequence number of the next append
+
+  uint8_t staged[TEMP_LOG_STAGING_BYTES];
+  size_t stagedCount;
+  size_t stagedCapacity;        // records that fit in `staged`
+  unsigned long firstStagedAt;  // millis() of the oldest staged record
+  unsigned long flushInterval;  // ms a record may stay staged
+  bool writeErrorLogged;
+
+  bool create();
+  bool writeHeader(File& f);
+  bool writeBlock(const uint8_t* recs, size_t n);
+  size_t readFlushed(uint32_t first, uint8_t* out, size_t n) const;
+  uint32_t timestampAt(File& f, uint32_t idx) const;
+  size_t slotOffset(uint32_t slot) const { return sizeof(Header) + (size_t)slot * recordSize; }
+};
+
+#endif // TIME_SERIES_STORE_H
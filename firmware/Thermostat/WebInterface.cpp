@@ -1,4 +1,5 @@
 #include "WebInterface.h"
+#include "SeriesCodec.h"
 #include <time.h>
 
 // Format a log entry's timestamp for display: HH:MM:SS UTC when NTP is
@@ -23,13 +24,15 @@ static String formatLogTime(const LogEntry& entry) {
   return String(buf);
 }
 
-WebInterface::WebInterface(TemperatureManager& tempMgr, RelayController& relayCtrl,
-                           ConfigManager& cfgMgr, ApiClient& apiCli, int& updateFreq, bool& useFahr)
+WebInterface::WebInterface(TemperatureManager& tempMgr, Relays& relayCtrl,
+                           ConfigManager& cfgMgr, ScheduleManager& schedMgr, ApiClient& api,
+                           int& updateFreq, bool& useFahr)
   : server(WEB_SERVER_PORT),
     tempManager(tempMgr),
     relayController(relayCtrl),
     configManager(cfgMgr),
-    apiClient(apiCli),
+    scheduleManager(schedMgr),
+    apiClient(api),
     updateFrequency(updateFreq),
     useFahrenheit(useFahr) {
 }
@@ -41,6 +44,10 @@ void WebInterface::begin() {
   server.on("/setmode", [this]() { this->handleSetMode(); });
   server.on("/settype", [this]() { this->handleSetType(); });
   server.on("/setthresholds", [this]() { this->handleSetThresholds(); });
+  server.on("/setpid", [this]() { this->handleSetPid(); });
+  server.on("/setcycle", [this]() { this->handleSetCycleLimits(); });
+  server.on("/schedule", HTTP_GET, [this]() { this->handleGetSchedule(); });
+  server.on("/schedule", HTTP_POST, [this]() { this->handleSetSchedule(); });
   server.on("/setfreq", [this]() { this->handleSetFrequency(); });
   server.on("/setunit", [this]() { this->handleSetUnit(); });
   server.on("/cleardata", [this]() { this->handleClearData(); });
@@ -84,28 +91,10 @@ static const char BODY_HTML[] PROGMEM = R"rawliteral(<h1>Thermostat Control</h1>
 <button id='unitToggle' class='btn-auto' onclick='toggleUnit()' style='padding:4px 10px;font-size:12px;'>°F</button>
 </div>
 <div class='temp'>Temperature: <span id='temp'>--</span><span id='unit'>&deg;C</span></div>
+<div id='sensors' style='font-size:14px;color:#555;'></div>
 <table>
 <tr><th>Relay</th><th>State</th><th>Type</th><th>Mode</th><th>ON</th><th>OFF</th><th>Actions</th></tr>
-<tr><td><b>1</b></td><td><span class='status-cell' id='status0'>--</span></td>
-<td><select id='type0' onchange='setType(0)'><option value='HEATING'>Heat</option><option value='COOLING'>Cool</option><option value='GENERIC'>Gen</option><option value='MANUAL_ONLY'>Man</option></select></td>
-<td id='mode0'>--</td><td><input type='number' id='on0' step='0.1'><span class='unit-label'>&deg;C</span></td>
-<td><input type='number' id='off0' step='0.1'><span class='unit-label'>&deg;C</span></td>
-<td><button class='btn-auto' onclick='setMode(0,"AUTO")'>A</button><button class='btn-on' onclick='setMode(0,"ON")'>On</button><button class='btn-off' onclick='setMode(0,"OFF")'>Off</button><button class='btn-auto' onclick='saveThreshold(0)'>Save</button></td></tr>
-<tr><td><b>2</b></td><td><span class='status-cell' id='status1'>--</span></td>
-<td><select id='type1' onchange='setType(1)'><option value='HEATING'>Heat</option><option value='COOLING'>Cool</option><option value='GENERIC'>Gen</option><option value='MANUAL_ONLY'>Man</option></select></td>
-<td id='mode1'>--</td><td><input type='number' id='on1' step='0.1'><span class='unit-label'>&deg;C</span></td>
-<td><input type='number' id='off1' step='0.1'><span class='unit-label'>&deg;C</span></td>
-<td><button class='btn-auto' onclick='setMode(1,"AUTO")'>A</button><button class='btn-on' onclick='setMode(1,"ON")'>On</button><button class='btn-off' onclick='setMode(1,"OFF")'>Off</button><button class='btn-auto' onclick='saveThreshold(1)'>Save</button></td></tr>
-<tr><td><b>3</b></td><td><span class='status-cell' id='status2'>--</span></td>
-<td><select id='type2' onchange='setType(2)'><option value='HEATING'>Heat</option><option value='COOLING'>Cool</option><option value='GENERIC'>Gen</option><option value='MANUAL_ONLY'>Man</option></select></td>
-<td id='mode2'>--</td><td><input type='number' id='on2' step='0.1'><span class='unit-label'>&deg;C</span></td>
-<td><input type='number' id='off2' step='0.1'><span class='unit-label'>&deg;C</span></td>
-<td><button class='btn-auto' onclick='setMode(2,"AUTO")'>A</button><button class='btn-on' onclick='setMode(2,"ON")'>On</button><button class='btn-off' onclick='setMode(2,"OFF")'>Off</button><button class='btn-auto' onclick='saveThreshold(2)'>Save</button></td></tr>
-<tr><td><b>4</b></td><td><span class='status-cell' id='status3'>--</span></td>
-<td><select id='type3' onchange='setType(3)'><option value='HEATING'>Heat</option><option value='COOLING'>Cool</option><option value='GENERIC'>Gen</option><option value='MANUAL_ONLY'>Man</option></select></td>
-<td id='mode3'>--</td><td><input type='number' id='on3' step='0.1'><span class='unit-label'>&deg;C</span></td>
-<td><input type='number' id='off3' step='0.1'><span class='unit-label'>&deg;C</span></td>
-<td><button class='btn-auto' onclick='setMode(3,"AUTO")'>A</button><button class='btn-on' onclick='setMode(3,"ON")'>On</button><button class='btn-off' onclick='setMode(3,"OFF")'>Off</button><button class='btn-auto' onclick='saveThreshold(3)'>Save</button></td></tr>
+<tbody id='relayRows'></tbody>
 </table>
 <div style='margin:20px auto;max-width:600px;'>
 <p><label style='font-weight:bold;'>Update Frequency:</label>
@@ -114,27 +103,34 @@ static const char BODY_HTML[] PROGMEM = R"rawliteral(<h1>Thermostat Control</h1>
 <p><button class='btn-off' onclick='clearData()' style='padding:8px 16px;'>Clear Data</button>
 <span id='clearStatus' style='margin-left:10px;font-size:12px;'></span></p>
 </div>
+<div style='margin-top:20px;'><label style='font-weight:bold;'>History:</label>
+<select id='range' onchange='updateChart()' style='width:90px;'><option value=''>Recent</option><option value='6h'>6 h</option><option value='24h'>24 h</option><option value='7d'>7 days</option><option value='30d'>30 days</option></select></div>
 <div id='chart-container'><canvas id='tempChart'></canvas></div>
 )rawliteral";
 
 static const char JS_CONTENT[] PROGMEM = R"rawliteral(<script src='https://cdn.jsdelivr.net/npm/chart.js@3.9.1/dist/chart.min.js'></script>
 <script>
 const editedInputs=new Set();let useFahrenheit=false;
+(function(){let h='';for(let i=0;i<NR;i++){h+="<tr><td><b>"+(i+1)+"</b></td><td><span class='status-cell' id='status"+i+"'>--</span></td><td><select id='type"+i+"' onchange='setType("+i+")'><option value='HEATING'>Heat</option><option value='COOLING'>Cool</option><option value='GENERIC'>Gen</option><option value='MANUAL_ONLY'>Man</option></select></td><td id='mode"+i+"'>--</td><td><input type='number' id='on"+i+"' step='0.1'><span class='unit-label'>&deg;C</span></td><td><input type='number' id='off"+i+"' step='0.1'><span class='unit-label'>&deg;C</span></td><td><button class='btn-auto' onclick='setMode("+i+",\"AUTO\")'>A</button><button class='btn-on' onclick='setMode("+i+",\"ON\")'>On</button><button class='btn-off' onclick='setMode("+i+",\"OFF\")'>Off</button><button class='btn-auto' onclick='setMode("+i+",\"PID\")'>P</button><button class='btn-auto' onclick='saveThreshold("+i+")'>Save</button></td></tr>"}document.getElementById('relayRows').innerHTML=h})();
 function c2f(c){return(c*9/5)+32}
 function f2c(f){return(f-32)*5/9}
 async function toggleUnit(){try{useFahrenheit=!useFahrenheit;const r=await fetch('/setunit?fahrenheit='+(useFahrenheit?'1':'0'));updateUnitLabels();updateFromData(await r.json())}catch(e){await updateStatus()}}
 function updateUnitLabels(){const u=useFahrenheit?'°F':'°C';document.getElementById('unit').innerHTML=u;document.getElementById('unitToggle').innerHTML=useFahrenheit?'°C':'°F';document.querySelectorAll('.unit-label').forEach(el=>el.innerHTML=u)}
-window.addEventListener('DOMContentLoaded',()=>{for(let i=0;i<4;i++){document.getElementById('on'+i).addEventListener('input',e=>editedInputs.add(e.target.id));document.getElementById('off'+i).addEventListener('input',e=>editedInputs.add(e.target.id))}});
+window.addEventListener('DOMContentLoaded',()=>{for(let i=0;i<NR;i++){document.getElementById('on'+i).addEventListener('input',e=>editedInputs.add(e.target.id));document.getElementById('off'+i).addEventListener('input',e=>editedInputs.add(e.target.id))}});
 async function setMode(relay,mode){try{const r=await fetch('/setmode?relay='+relay+'&mode='+mode);updateFromData(await r.json())}catch(e){await updateStatus()}}
 async function setType(relay){try{const t=document.getElementById('type'+relay).value;const r=await fetch('/settype?relay='+relay+'&type='+t);updateFromData(await r.json())}catch(e){await updateStatus()}}
 async function saveThreshold(relay){try{let on=parseFloat(document.getElementById('on'+relay).value);let off=parseFloat(document.getElementById('off'+relay).value);if(useFahrenheit){on=f2c(on);off=f2c(off)}const r=await fetch('/setthresholds?relay='+relay+'&on='+on+'&off='+off);editedInputs.delete('on'+relay);editedInputs.delete('off'+relay);updateFromData(await r.json())}catch(e){await updateStatus()}}
 async function setFrequency(){try{const f=parseInt(document.getElementById('freq').value);if(isNaN(f)||f<5){alert('Min 5s');return}if(f>300){alert('Max 300s');return}const r=await fetch('/setfreq?sec='+f);updateFromData(await r.json())}catch(e){await updateStatus()}}
 async function clearData(){if(!confirm('Clear all data?'))return;const s=document.getElementById('clearStatus');s.innerText='Clearing...';try{const r=await fetch('/cleardata');const d=await r.json();s.innerText=d.message||'Done';setTimeout(()=>{s.innerText='';updateChart()},3000)}catch(e){s.innerText='Error'}}
-function updateFromData(d){if(d.useFahrenheit!==undefined&&d.useFahrenheit!==useFahrenheit){useFahrenheit=d.useFahrenheit;updateUnitLabels()}const dt=useFahrenheit?c2f(d.temp):d.temp;document.getElementById('temp').innerText=dt.toFixed(1);if(d.freq){const fi=document.getElementById('freq');if(document.activeElement!==fi)fi.value=d.freq}for(let i=0;i<4;i++){const st=document.getElementById('status'+i);st.innerText=d.relays[i].state?'ON':'OFF';st.className='status-cell '+(d.relays[i].state?'on':'off');document.getElementById('mode'+i).innerText=d.relays[i].mode;const ts=document.getElementById('type'+i);if(document.activeElement!==ts&&d.relays[i].type)ts.value=d.relays[i].type;const oi=document.getElementById('on'+i),fi=document.getElementById('off'+i);const don=useFahrenheit?c2f(d.relays[i].tempOn):d.relays[i].tempOn;const doff=useFahrenheit?c2f(d.relays[i].tempOff):d.relays[i].tempOff;if(document.activeElement!==oi&&!editedInputs.has('on'+i))oi.value=don.toFixed(1);if(document.activeElement!==fi&&!editedInputs.has('off'+i))fi.value=doff.toFixed(1)}}
+function updateFromData(d){if(d.useFahrenheit!==undefined&&d.useFahrenheit!==useFahrenheit){useFahrenheit=d.useFahrenheit;updateUnitLabels()}const dt=useFahrenheit?c2f(d.temp):d.temp;document.getElementById('temp').innerText=dt.toFixed(1);if(d.sensors){document.getElementById('sensors').innerText=d.sensors.length>1?d.sensors.map(x=>'S'+x.id+': '+(useFahrenheit?c2f(x.temp):x.temp).toFixed(1)).join('  '):''}if(d.freq){const fi=document.getElementById('freq');if(document.activeElement!==fi)fi.value=d.freq}for(let i=0;i<NR;i++){const st=document.getElementById('status'+i);st.innerText=(d.relays[i].state?'ON':'OFF')+(d.relays[i].deferred?' \u2192'+(d.relays[i].deferred.state?'ON':'OFF')+' '+d.relays[i].deferred.in+'s':'');st.className='status-cell '+(d.relays[i].state?'on':'off');document.getElementById('mode'+i).innerText=d.relays[i].mode+(d.relays[i].mode==='PID'?' '+Math.round(d.relays[i].pid.duty*100)+'%':'');const ts=document.getElementById('type'+i);if(document.activeElement!==ts&&d.relays[i].type)ts.value=d.relays[i].type;const oi=document.getElementById('on'+i),fi=document.getElementById('off'+i);const don=useFahrenheit?c2f(d.relays[i].tempOn):d.relays[i].tempOn;const doff=useFahrenheit?c2f(d.relays[i].tempOff):d.relays[i].tempOff;if(document.activeElement!==oi&&!editedInputs.has('on'+i))oi.value=don.toFixed(1);if(document.activeElement!==fi&&!editedInputs.has('off'+i))fi.value=doff.toFixed(1)}}
 async function updateStatus(){try{const r=await fetch('/status');updateFromData(await r.json())}catch(e){}}
 const ctx=document.getElementById('tempChart').getContext('2d');
-const tempChart=new Chart(ctx,{type:'line',data:{labels:[],datasets:[{label:'Temp',data:[],borderColor:'#2196F3',backgroundColor:'rgba(33,150,243,0.1)',borderWidth:2,tension:0.4,pointRadius:1}]},options:{responsive:true,maintainAspectRatio:true,interaction:{intersect:false,mode:'index'},scales:{y:{beginAtZero:false},x:{ticks:{maxRotation:45,autoSkip:true,maxTicksLimit:12}}},plugins:{legend:{display:true}},animation:false}});
-async function updateChart(){try{const r=await fetch('/data');const t=await r.text();const lines=t.trim().split('\n');const temps=[],times=[];for(const line of lines){if(line.startsWith('#')||!line)continue;const p=line.split(',');if(p.length>=2){const ts=parseInt(p[0]);let temp=parseFloat(p[1]);if(!isNaN(ts)&&!isNaN(temp)){if(useFahrenheit)temp=c2f(temp);let dt;if(ts>1e9)dt=new Date(ts*1000).toLocaleTimeString();else{const h=Math.floor(ts/3600),m=Math.floor((ts%3600)/60);dt=h+'h'+m+'m'}temps.push(temp);times.push(dt)}}}tempChart.data.labels=times;tempChart.data.datasets[0].data=temps;tempChart.update('none')}catch(e){}}
+const COLORS=['#2196F3','#FF9800','#4CAF50','#9C27B0'];
+const tempChart=new Chart(ctx,{type:'line',data:{labels:[],datasets:[]},options:{responsive:true,maintainAspectRatio:true,interaction:{intersect:false,mode:'index'},scales:{y:{beginAtZero:false},x:{ticks:{maxRotation:45,autoSkip:true,maxTicksLimit:12}}},plugins:{legend:{display:true}},animation:false}});
+function fmtTs(ts,long){if(ts>1e9){const d=new Date(ts*1000);return long?d.toLocaleDateString()+' '+d.toLocaleTimeString([],{hour:'2-digit',minute:'2-digit'}):d.toLocaleTimeString()}const h=Math.floor(ts/3600),m=Math.floor((ts%3600)/60);return h+'h'+m+'m'}
+function seriesDecoder(){let pend=new Uint8Array(0),stats=-1;const st={};const zz=x=>x%2?-(x+1)/2:x/2;return function(chunk,out){const b=new Uint8Array(pend.length+chunk.length);b.set(pend);b.set(chunk,pend.length);let p=0;if(stats<0){if(b.length<4){pend=b;return}stats=b[3]&1;p=4}const need=stats?6:3;for(;;){const s0=p,v=[];for(let k=0;k<need;k++){let x=0,m=1,c;do{if(p>=b.length){pend=b.slice(s0);return}c=b[p++];x+=(c&127)*m;m*=128}while(c&128);v.push(x)}const s=st[v[0]]=st[v[0]]||{ts:0,d:0,c:0,n:0};s.d+=zz(v[1]);s.ts+=s.d;s.c+=zz(v[2]);const rec={ts:s.ts,sid:v[0],t:s.c/100};if(stats){rec.min=(s.c+zz(v[3]))/100;rec.max=(s.c+zz(v[4]))/100;s.n+=zz(v[5]);rec.n=s.n}out.push(rec)}}}
+async function fetchSeries(url){const r=await fetch(url);if(!r.ok)return[];const rd=r.body.getReader();const push=seriesDecoder();const out=[];for(;;){const{done,value}=await rd.read();if(done)break;push(value,out)}return out}
+async function updateChart(){try{const rg=document.getElementById('range').value;const recs=await fetchSeries('/data?format=bin'+(rg?'&range='+rg:''));const series={},times=[],idx={};for(const x of recs){let temp=x.t;if(useFahrenheit)temp=c2f(temp);if(!(x.ts in idx)){idx[x.ts]=times.length;times.push(x.ts)}(series[x.sid]=series[x.sid]||{})[x.ts]=temp}const ids=Object.keys(series).sort((a,b)=>a-b);tempChart.data.labels=times.map(ts=>fmtTs(ts,rg==='7d'||rg==='30d'));tempChart.data.datasets=ids.map((sid,i)=>({label:ids.length>1?'S'+sid:'Temp',data:times.map(ts=>series[sid][ts]??null),spanGaps:true,borderColor:COLORS[i%COLORS.length],backgroundColor:'rgba(33,150,243,0.1)',borderWidth:2,tension:0.4,pointRadius:1}));tempChart.update('none')}catch(e){}}
 updateStatus();setInterval(updateStatus,2000);updateChart();setInterval(updateChart,30000);
 </script>
 )rawliteral";
@@ -151,6 +147,8 @@ void WebInterface::handleRoot() {
   server.sendContent_P(CSS_CONTENT);
   server.sendContent_P(PSTR("</head><body>"));
   server.sendContent_P(BODY_HTML);
+  // Relay rows are built client-side from the board's relay count
+  server.sendContent("<script>const NR=" + String(RELAY_COUNT) + ";</script>");
   server.sendContent_P(JS_CONTENT);
   server.sendContent_P(PSTR("</body></html>"));
 }
@@ -162,15 +160,54 @@ void WebInterface::handleStatus() {
   JsonDocument doc;
   doc["temp"] = tempManager.getCurrentTemp();
   doc["freq"] = updateFrequency;
+  doc["sampleInterval"] = tempManager.getSampleInterval() / 1000.0;
+  doc["resolution"] = tempManager.getResolution();
   doc["useFahrenheit"] = useFahrenheit;
+  JsonArray sensors = doc["sensors"].to<JsonArray>();
+  for (uint8_t i = 0; i < tempManager.getSensorCount(); i++) {
+    JsonObject s = sensors.add<JsonObject>();
+    s["id"]      = i;
+    s["address"] = tempManager.getSensorAddress(i);
+    s["temp"]    = tempManager.getCurrentTemp(i);
+    s["rate"]    = tempManager.getRateOfChange(i);
+  }
   JsonArray relays = doc["relays"].to<JsonArray>();
-  for (int i = 0; i < 4; i++) {
+  for (int i = 0; i < RELAY_COUNT; i++) {
     JsonObject r = relays.add<JsonObject>();
     r["state"]   = relayController.getRelayState(i);
-    r["mode"]    = RelayController::modeToString(relayController.getRelayMode(i));
-    r["type"]    = RelayController::typeToString(relayController.getRelayType(i));
+    r["mode"]    = Relays::modeToString(relayController.getRelayMode(i));
+    r["type"]    = Relays::typeToString(relayController.getRelayType(i));
     r["tempOn"]  = relayController.getTempOn(i);
     r["tempOff"] = relayController.getTempOff(i);
+    r["scheduled"] = scheduleManager.isScheduled(i);
+    const PidSettings& pid = relayController.getPidSettings(i);
+    JsonObject p = r["pid"].to<JsonObject>();
+    p["kp"]     = pid.kp;
+    p["ki"]     = pid.ki;
+    p["kd"]     = pid.kd;
+    p["window"] = pid.windowSec;
+    p["duty"]   = relayController.getPidOutput(i);
+    const CycleLimits& l = relayController.getCycleLimits(i);
+    JsonObject c = r["cycle"].to<JsonObject>();
+    c["minOn"]     = l.minOnSec;
+    c["minOff"]    = l.minOffSec;
+    c["maxCycles"] = l.maxCyclesPerHour;
+    if (relayController.isDeferred(i)) {
+      JsonObject d = r["deferred"].to<JsonObject>();
+      d["state"] = relayController.getDeferredState(i);
+      d["in"]    = relayController.getDeferredRemaining(i);
+    }
+  }
+  // Retry state per backend endpoint; retryIn in seconds
+  unsigned long now = millis();
+  JsonObject backend = doc["backend"].to<JsonObject>();
+  backend["registered"] = apiClient.isRegistered();
+  for (uint8_t e = 0; e < API_ENDPOINT_COUNT; e++) {
+    const CircuitBreaker& b = apiClient.getBreaker((ApiEndpoint)e);
+    JsonObject ep = backend[ApiClient::endpointName((ApiEndpoint)e)].to<JsonObject>();
+    ep["state"]    = CircuitBreaker::stateToString(b.getState(now));
+    ep["failures"] = b.getFailures();
+    ep["retryIn"]  = (b.getRetryIn(now) + 999) / 1000;
   }
   String out;
   out.reserve(measureJson(doc) + 1);
@@ -182,14 +219,13 @@ void WebInterface::handleSetMode() {
   if (server.hasArg("relay") && server.hasArg("mode")) {
     int relay = server.arg("relay").toInt();
     String mode = server.arg("mode");
-    if (relay >= 0 && relay < 4) {
+    if (Relays::isValidIndex(relay)) {
       if (mode == "AUTO") relayController.setRelayMode(relay, AUTO);
       else if (mode == "ON") relayController.setRelayMode(relay, MANUAL_ON);
       else if (mode == "OFF") relayController.setRelayMode(relay, MANUAL_OFF);
+      else if (mode == "PID") relayController.setRelayMode(relay, PID);
       logger.addLog("Relay " + String(relay + 1) + " mode: " + mode);
       relayController.applyRelayLogic(tempManager.getCurrentTemp());
-      configManager.saveSettings(updateFrequency, useFahrenheit);
-      apiClient.markRelayDirty(relay);
     }
   }
   handleStatus();
@@ -199,14 +235,12 @@ void WebInterface::handleSetType() {
   if (server.hasArg("relay") && server.hasArg("type")) {
     int relay = server.arg("relay").toInt();
     String type = server.arg("type");
-    if (relay >= 0 && relay < 4) {
+    if (Relays::isValidIndex(relay)) {
       if (type == "HEATING") relayController.setRelayType(relay, HEATING);
       else if (type == "COOLING") relayController.setRelayType(relay, COOLING);
       else if (type == "GENERIC") relayController.setRelayType(relay, GENERIC);
       else if (type == "MANUAL_ONLY") relayController.setRelayType(relay, MANUAL_ONLY);
       relayController.applyRelayLogic(tempManager.getCurrentTemp());
-      configManager.saveSettings(updateFrequency, useFahrenheit);
-      apiClient.markRelayDirty(relay);
     }
   }
   handleStatus();
@@ -215,20 +249,80 @@ void WebInterface::handleSetType() {
 void WebInterface::handleSetThresholds() {
   if (server.hasArg("relay") && server.hasArg("on") && server.hasArg("off")) {
     int relay = server.arg("relay").toInt();
-    if (relay >= 0 && relay < 4) {
+    if (Relays::isValidIndex(relay)) {
       float tempOn = server.arg("on").toFloat();
       float tempOff = server.arg("off").toFloat();
       relayController.setTempThresholds(relay, tempOn, tempOff);
       logger.addLog("Relay " + String(relay + 1) + " thresholds: ON=" +
                     String(tempOn, 1) + "C, OFF=" + String(tempOff, 1) + "C");
       relayController.applyRelayLogic(tempManager.getCurrentTemp());
-      configManager.saveSettings(updateFrequency, useFahrenheit);
-      apiClient.markRelayDirty(relay);
     }
   }
   handleStatus();
 }
 
+// Any of kp/ki/kd/window may be given; the rest keep their current value.
+void WebInterface::handleSetPid() {
+  if (server.hasArg("relay")) {
+    int relay = server.arg("relay").toInt();
+    if (Relays::isValidIndex(relay)) {
+      PidSettings pid = relayController.getPidSettings(relay);
+      if (server.hasArg("kp")) pid.kp = server.arg("kp").toFloat();
+      if (server.hasArg("ki")) pid.ki = server.arg("ki").toFloat();
+      if (server.hasArg("kd")) pid.kd = server.arg("kd").toFloat();
+      if (server.hasArg("window")) pid.windowSec = server.arg("window").toInt();
+      relayController.setPidSettings(relay, pid);
+      pid = relayController.getPidSettings(relay);
+      logger.addLog("Relay " + String(relay + 1) + " PID: Kp=" + String(pid.kp, 3) + " Ki=" +
+                    String(pid.ki, 3) + " Kd=" + String(pid.kd, 3) + " window=" + String(pid.windowSec) + "s");
+    }
+  }
+  handleStatus();
+}
+
+// Any of minon/minoff (seconds) and maxcycles (per hour, 0 = unlimited) may
+// be given; the rest keep their current value.
+void WebInterface::handleSetCycleLimits() {
+  if (server.hasArg("relay")) {
+    int relay = server.arg("relay").toInt();
+    if (Relays::isValidIndex(relay)) {
+      CycleLimits l = relayController.getCycleLimits(relay);
+      if (server.hasArg("minon")) l.minOnSec = constrain(server.arg("minon").toInt(), 0, 3600);
+      if (server.hasArg("minoff")) l.minOffSec = constrain(server.arg("minoff").toInt(), 0, 3600);
+      if (server.hasArg("maxcycles")) l.maxCyclesPerHour = constrain(server.arg("maxcycles").toInt(), 0, RELAY_CYCLE_HISTORY);
+      relayController.setCycleLimits(relay, l);
+      logger.addLog("Relay " + String(relay + 1) + " cycle limits: min on " + String(l.minOnSec) +
+                    "s, min off " + String(l.minOffSec) + "s, max " + String(l.maxCyclesPerHour) + "/h");
+    }
+  }
+  handleStatus();
+}
+
+void WebInterface::handleGetSchedule() {
+  JsonDocument doc;
+  scheduleManager.toJson(doc);
+  String out;
+  serializeJson(doc, out);
+  server.send(200, "application/json", out);
+}
+
+// Body is the whole schedule as JSON (see ScheduleManager::setFromJson);
+// it replaces the current one.
+void WebInterface::handleSetSchedule() {
+  JsonDocument doc;
+  DeserializationError err = deserializeJson(doc, server.arg("plain"));
+  String error = err ? String("invalid JSON: ") + err.c_str() : String();
+  if (err || !scheduleManager.setFromJson(doc, error)) {
+    JsonDocument resp;
+    resp["error"] = error;
+    String out;
+    serializeJson(resp, out);
+    server.send(400, "application/json", out);
+    return;
+  }
+  handleGetSchedule();
+}
+
 void WebInterface::handleSetFrequency() {
   if (server.hasArg("sec")) {
     int sec = server.arg("sec").toInt();
@@ -241,9 +335,16 @@ void WebInterface::handleSetFrequency() {
   handleStatus();
 }
 
+// Clears every tier even when the raw ring is already empty: the rollups
+// outlive it.
 void WebInterface::handleClearData() {
-  if (LittleFS.exists(LOG_FILE)) {
-    LittleFS.remove(LOG_FILE);
+  bool hadData = tempManager.getLogStore().size() > 0;
+  for (int t = 0; t < TemperatureManager::ROLLUP_COUNT; t++) {
+    hadData |= tempManager.getRollup((TemperatureManager::RollupIndex)t).getStore().size() > 0;
+  }
+  tempManager.clearLog();
+
+  if (hadData) {
     logger.addLog("Temperature data cleared by user");
     server.send(200, "application/json", "{\"message\":\"Data cleared successfully\"}");
   } else {
@@ -422,55 +523,204 @@ void WebInterface::handleLogsJson() {
 }
 
 void WebInterface::handleData() {
-  if (!LittleFS.exists(LOG_FILE)) {
-    server.send(200, "text/plain", "# No data logged yet\n");
-    return;
-  }
+  // ?from=&to=[&step=] (unix seconds) and the ?range= shorthands are
+  // answered by binary search over the coarsest store that still resolves
+  // the step. Without either we send the most recent raw samples as before.
+  // ?format=bin switches either form to the SeriesCodec encoding.
+  bool binary = server.arg("format") == "bin";
+  if (server.hasArg("from") || server.hasArg("range")) {
+    time_t now = time(nullptr);
+    if (now < 1000000000) {
+      server.send(503, "text/plain", "# Error: clock not synced, time ranges unavailable\n");
+      return;
+    }
 
-  File f = LittleFS.open(LOG_FILE, "r");
-  if (!f) {
-    server.send(500, "text/plain", "# Error: Cannot open log file\n");
+    uint32_t from, to, step;
+    if (server.hasArg("range")) {
+      String range = server.arg("range");
+      uint32_t span;
+      if (range == "6h")       { span = 6 * 3600;   step = 60; }
+      else if (range == "24h") { span = 86400;      step = 900; }
+      else if (range == "7d")  { span = 7 * 86400;  step = 3600; }
+      else if (range == "30d") { span = 30 * 86400; step = 3600; }
+      else {
+        server.send(400, "text/plain", "# Error: range must be 6h, 24h, 7d or 30d\n");
+        return;
+      }
+      to = (uint32_t)now;
+      from = to - span;
+    } else {
+      from = strtoul(server.arg("from").c_str(), nullptr, 10);
+      to = server.hasArg("to") ? strtoul(server.arg("to").c_str(), nullptr, 10) : (uint32_t)now;
+      step = server.hasArg("step") ? strtoul(server.arg("step").c_str(), nullptr, 10) : 0;
+      if (from < 1000000000 || to < from) {
+        server.send(400, "text/plain", "# Error: from/to must be unix seconds with from <= to\n");
+        return;
+      }
+    }
+    sendRange(from, to, step, binary);
     return;
   }
 
-  size_t fileSize = f.size();
-  if (fileSize == 0) {
-    f.close();
-    server.send(200, "text/plain", "# Log file is empty\n");
+  const TimeSeriesStore& store = tempManager.getLogStore();
+  uint32_t total = store.size();
+  if (total == 0) {
+    if (binary) {
+      uint8_t header[SeriesEncoder::HEADER_BYTES];
+      SeriesEncoder(false).writeHeader(header);
+      server.send(200, "application/octet-stream", (const char*)header, sizeof(header));
+    } else {
+      server.send(200, "text/plain", "# No data logged yet\n");
+    }
     return;
   }
 
-  // Calculate lines needed for 24 hours based on update frequency
-  // Cap at MAX_DATA_LINES for memory safety
-  int linesFor24h = (86400 / updateFrequency);
+  // Aim for 24 hours of raw samples, capped at MAX_DATA_LINES for memory
+  // safety (~40 min at 5 s) — longer windows go through ?range= instead
+  int linesFor24h = (86400 / updateFrequency) * tempManager.getSensorCount();
   if (linesFor24h > MAX_DATA_LINES) linesFor24h = MAX_DATA_LINES;
   if (linesFor24h < MIN_DATA_LINES) linesFor24h = MIN_DATA_LINES;
 
-  // For large files, seek to approximately the right position
-  long estimatedBytes = linesFor24h * BYTES_PER_LINE_ESTIMATE;
-  if (fileSize > estimatedBytes) {
-    f.seek(fileSize - estimatedBytes);
-    f.readStringUntil('\n'); // Skip partial line
-  }
+  // Fixed-size records: the start of the window is an exact index
+  uint32_t lines = (uint32_t)linesFor24h < total ? (uint32_t)linesFor24h : total;
+  uint32_t first = total - lines;
 
   // Use chunked transfer - send headers first
   server.setContentLength(CONTENT_LENGTH_UNKNOWN);
-  server.send(200, "text/plain", "");
-
-  // Stream data line by line
-  int lineCount = 0;
-  String line = "";
-
-  while (f.available() && lineCount < linesFor24h) {
-    line = f.readStringUntil('\n');
-    if (line.length() > 0) {
-      line += "\n";
-      server.sendContent(line);
-      lineCount++;
-      if (lineCount % 10 == 0) yield(); // Feed watchdog every 10 lines
+  server.send(200, binary ? "application/octet-stream" : "text/plain", "");
+
+  // Read a block of records at a time and send them as one chunk
+  const size_t BATCH = 32;
+  TempRecord batch[BATCH];
+  uint8_t chunk[BATCH * SeriesEncoder::MAX_RECORD_BYTES];
+  SeriesEncoder encoder(false);
+  size_t len = binary ? encoder.writeHeader(chunk) : 0;
+  uint32_t pos = first;
+  while (pos < total) {
+    size_t n = store.read(pos, batch, BATCH);
+    if (n == 0) break;
+    for (size_t i = 0; i < n; i++) {
+      if (binary) {
+        len += encoder.encode(chunk + len, batch[i].timestamp, batch[i].sensorId, batch[i].centiC);
+      } else {
+        len += snprintf((char*)chunk + len, sizeof(chunk) - len, "%lu,%.2f,%u\n",
+                        (unsigned long)batch[i].timestamp,
+                        TimeSeriesStore::fromCenti(batch[i].centiC),
+                        batch[i].sensorId);
+      }
     }
+    server.sendContent((const char*)chunk, len);
+    len = 0;
+    pos += n;
+    yield(); // Feed watchdog between batches
   }
 
-  f.close();
   server.sendContent(""); // Signal end of chunked response
 }
+
+// Stream [from, to] as "bucket,avg,sensor,min,max,count" lines (or the
+// equivalent SeriesCodec records when binary), one per sensor per `step` seconds (step 0 = every stored record). The source is
+// the coarsest store whose period still fits the step, and the window's
+// ends are found by binary search, so latency depends on the size of the
+// answer rather than on how much history is on flash. A rollup tier's open
+// buckets are included, so the newest partial period shows up too.
+void WebInterface::sendRange(uint32_t from, uint32_t to, uint32_t step, bool binary) {
+  // Raise the step so the response stays bounded however wide the window is
+  uint32_t sensorCount = tempManager.getSensorCount();
+  uint64_t minStep = ((uint64_t)(to - from) * sensorCount + MAX_QUERY_POINTS - 1) / MAX_QUERY_POINTS;
+  if (step < minStep) step = (uint32_t)minStep;
+
+  const RollupTier* tier = nullptr;
+  if (step >= 3600)     tier = &tempManager.getRollup(TemperatureManager::ROLLUP_1H);
+  else if (step >= 900) tier = &tempManager.getRollup(TemperatureManager::ROLLUP_15M);
+  else if (step >= 60)  tier = &tempManager.getRollup(TemperatureManager::ROLLUP_1M);
+  const TimeSeriesStore* store = tier ? &tier->getStore() : &tempManager.getLogStore();
+  bool isRollup = tier != nullptr;
+
+  uint32_t lo = store->lowerBound(from);
+  uint32_t hi = (to == UINT32_MAX) ? store->size() : store->lowerBound(to + 1);
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, binary ? "application/octet-stream" : "text/plain", "");
+
+  // Per-sensor decimation bucket; rollup records merge weighted by count
+  struct Acc { uint32_t start; int64_t sum; uint32_t count; int16_t minC; int16_t maxC; };
+  Acc acc[MAX_TEMP_SENSORS];
+  for (uint8_t s = 0; s < MAX_TEMP_SENSORS; s++) acc[s].count = 0;
+
+  char chunk[768];
+  SeriesEncoder encoder(true);
+  size_t len = binary ? encoder.writeHeader((uint8_t*)chunk) : 0;
+  auto emit = [&](uint8_t sensorId) {
+    Acc& a = acc[sensorId];
+    if (a.count == 0) return;
+    int16_t avgC = (int16_t)(a.sum / (int64_t)a.count);
+    if (binary) {
+      len += encoder.encode((uint8_t*)chunk + len, a.start, sensorId, avgC, a.minC, a.maxC, a.count);
+    } else {
+      len += snprintf(chunk + len, sizeof(chunk) - len, "%lu,%.2f,%u,%.2f,%.2f,%lu\n",
+                      (unsigned long)a.start,
+                      TimeSeriesStore::fromCenti(avgC),
+                      sensorId,
+                      TimeSeriesStore::fromCenti(a.minC),
+                      TimeSeriesStore::fromCenti(a.maxC),
+                      (unsigned long)a.count);
+    }
+    a.count = 0;
+    if (len > sizeof(chunk) - 48) {
+      server.sendContent(chunk, len);
+      len = 0;
+    }
+  };
+  auto add = [&](uint32_t ts, uint8_t sensorId, int16_t avgC, int16_t minC, int16_t maxC, uint16_t count) {
+    if (ts < 1000000000 || sensorId >= MAX_TEMP_SENSORS || count == 0) return; // pre-NTP records
+
+    uint32_t start = step > 0 ? ts - (ts % step) : ts;
+    Acc& a = acc[sensorId];
+    if (a.count > 0 && a.start != start) emit(sensorId);
+    if (a.count == 0) {
+      a.start = start;
+      a.sum = 0;
+      a.minC = minC;
+      a.maxC = maxC;
+    }
+    a.sum += (int64_t)avgC * count;
+    a.count += count;
+    if (minC < a.minC) a.minC = minC;
+    if (maxC > a.maxC) a.maxC = maxC;
+  };
+
+  const size_t BATCH = 32;
+  uint8_t batch[BATCH * sizeof(RollupRecord)];
+  size_t recSize = isRollup ? sizeof(RollupRecord) : sizeof(TempRecord);
+  uint32_t pos = lo;
+  while (pos < hi) {
+    size_t want = hi - pos < BATCH ? hi - pos : BATCH;
+    size_t n = store->read(pos, batch, want);
+    if (n == 0) break;
+
+    for (size_t i = 0; i < n; i++) {
+      if (isRollup) {
+        const RollupRecord* r = (const RollupRecord*)(batch + i * recSize);
+        add(r->bucketStart, r->sensorId, r->avgC, r->minC, r->maxC, r->count);
+      } else {
+        const TempRecord* r = (const TempRecord*)(batch + i * recSize);
+        add(r->timestamp, r->sensorId, r->centiC, r->centiC, r->centiC, 1);
+      }
+    }
+    pos += n;
+    yield(); // Feed watchdog between batches
+  }
+
+  // Open buckets are newer than anything the tier has stored
+  RollupRecord partial;
+  for (uint8_t s = 0; tier && s < MAX_TEMP_SENSORS; s++) {
+    if (tier->openBucket(s, partial) && partial.bucketStart >= from && partial.bucketStart <= to) {
+      add(partial.bucketStart, s, partial.avgC, partial.minC, partial.maxC, partial.count);
+    }
+  }
+
+  for (uint8_t s = 0; s < MAX_TEMP_SENSORS; s++) emit(s);
+  if (len > 0) server.sendContent(chunk, len);
+  server.sendContent("");
+}
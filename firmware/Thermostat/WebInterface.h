@@ -9,12 +9,14 @@
 #include "TemperatureManager.h"
 #include "RelayController.h"
 #include "ConfigManager.h"
+#include "ScheduleManager.h"
 #include "ApiClient.h"
 
 class WebInterface {
 public:
-  WebInterface(TemperatureManager& tempMgr, RelayController& relayCtrl,
-               ConfigManager& cfgMgr, ApiClient& apiCli, int& updateFreq, bool& useFahr);
+  WebInterface(TemperatureManager& tempMgr, Relays& relayCtrl,
+               ConfigManager& cfgMgr, ScheduleManager& schedMgr, ApiClient& api,
+               int& updateFreq, bool& useFahr);
 
   void begin();
   void handleClient();
@@ -22,8 +24,9 @@ public:
 private:
   ESP8266WebServer server;
   TemperatureManager& tempManager;
-  RelayController& relayController;
+  Relays& relayController;
   ConfigManager& configManager;
+  ScheduleManager& scheduleManager;
   ApiClient& apiClient;
   int& updateFrequency;
   bool& useFahrenheit;
@@ -34,12 +37,17 @@ private:
   void handleSetMode();
   void handleSetType();
   void handleSetThresholds();
+  void handleSetPid();
+  void handleSetCycleLimits();
+  void handleGetSchedule();
+  void handleSetSchedule();
   void handleSetFrequency();
   void handleClearData();
   void handleSetUnit();
   void handleLogs();
   void handleLogsJson();
   void handleData();
+  void sendRange(uint32_t from, uint32_t to, uint32_t step, bool binary);
 
 };
 
@@ -0,0 +1,25 @@
+#!/bin/bash
+# Host-side unit tests for firmware modules that don't touch hardware.
+# Builds each test_*.cpp against stubs/ with the system compiler.
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+SRC="$SCRIPT_DIR/../Thermostat"
+OUT="$(mktemp -d)"
+trap 'rm -rf "$OUT"' EXIT
+
+status=0
+for test in "$SCRIPT_DIR"/test_*.cpp; do
+  name="$(basename "$test" .cpp)"
+  sources=$(sed -n 's|^// sources: ||p' "$test")
+  if ! g++ -std=c++17 -Wall -I"$SCRIPT_DIR/stubs" -I"$SRC" -o "$OUT/$name" "$test" \
+       $(for s in $sources; do echo "$SRC/$s"; done); then
+    echo "✗ $name: build failed"
+    status=1
+  elif ! "$OUT/$name"; then
+    echo "✗ $name"
+    status=1
+  else
+    echo "✓ $name"
+  fi
+done
+exit $status
@@ -0,0 +1,31 @@
+// Just enough of the Arduino core to build firmware modules on the host
+#ifndef ARDUINO_STUB_H
+#define ARDUINO_STUB_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+enum { D0 = 16, D1 = 5, D2 = 4, D3 = 0, D4 = 2, D5 = 14, D6 = 12, D7 = 13, D8 = 15 };
+
+inline unsigned long fakeMillis = 0;
+inline unsigned long millis() { return fakeMillis; }
+inline void delay(unsigned long ms) { fakeMillis += ms; }
+inline void yield() {}
+
+class String : public std::string {
+public:
+  String() {}
+  String(const char* s) : std::string(s) {}
+  String(const std::string& s) : std::string(s) {}
+  String(int v) : std::string(std::to_string(v)) {}
+  String(unsigned int v) : std::string(std::to_string(v)) {}
+  String(long v) : std::string(std::to_string(v)) {}
+  String(unsigned long v) : std::string(std::to_string(v)) {}
+  unsigned int length() const { return size(); }
+};
+
+#endif
@@ -0,0 +1,2 @@
+// Host tests never talk to the backend
+#define API_KEY "test"
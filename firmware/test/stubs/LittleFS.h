@@ -0,0 +1,52 @@
+// In-memory LittleFS: files are byte vectors keyed by path
+#ifndef LITTLEFS_STUB_H
+#define LITTLEFS_STUB_H
+
+#include <map>
+#include <vector>
+#include "Arduino.h"
+
+class File {
+public:
+  File() : data(nullptr), pos(0) {}
+  explicit File(std::vector<uint8_t>* data) : data(data), pos(0) {}
+  explicit operator bool() const { return data != nullptr; }
+
+  size_t read(uint8_t* buf, size_t n) {
+    if (pos >= data->size()) return 0;
+    if (n > data->size() - pos) n = data->size() - pos;
+    memcpy(buf, data->data() + pos, n);
+    pos += n;
+    return n;
+  }
+  size_t write(const uint8_t* buf, size_t n) {
+    if (data->size() < pos + n) data->resize(pos + n);
+    memcpy(data->data() + pos, buf, n);
+    pos += n;
+    return n;
+  }
+  bool seek(size_t p) { pos = p; return true; }
+  size_t size() const { return data->size(); }
+  void close() { data = nullptr; }
+
+private:
+  std::vector<uint8_t>* data;
+  size_t pos;
+};
+
+class FS {
+public:
+  File open(const char* path, const char* mode) {
+    auto it = files.find(path);
+    if (mode[0] == 'w') return File(&(files[path] = {}));
+    return it == files.end() ? File() : File(&it->second);
+  }
+  bool remove(const char* path) { return files.erase(path) > 0; }
+  bool exists(const char* path) const { return files.count(path) > 0; }
+
+  std::map<std::string, std::vector<uint8_t>> files;
+};
+
+inline FS LittleFS;
+
+#endif
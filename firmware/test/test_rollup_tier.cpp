@@ -0,0 +1,43 @@
+// sources: RollupTier.cpp TimeSeriesStore.cpp
+#include <cassert>
+#include "RollupTier.h"
+
+SystemLogger logger;
+SystemLogger::SystemLogger() {}
+void SystemLogger::addLog(String) {}
+
+static const uint32_t T0 = 1700000040;  // a minute boundary
+
+static void testOpenBucketAndFlush() {
+  LittleFS.files.clear();
+  RollupTier tier("/r.dat", 60, 16);
+  assert(tier.begin());
+
+  RollupRecord rec;
+  assert(!tier.openBucket(0, rec));
+  tier.add(T0 + 1, 2000, 0);
+  tier.add(T0 + 30, 2200, 0);
+  assert(tier.getStore().size() == 0);
+
+  // The open bucket reads like a closed one would
+  assert(tier.openBucket(0, rec));
+  assert(rec.bucketStart == T0 && rec.count == 2 && rec.avgC == 2100 && rec.minC == 2000 && rec.maxC == 2200);
+
+  // A restart flush keeps it
+  tier.flush();
+  assert(!tier.openBucket(0, rec));
+  assert(tier.getStore().size() == 1);
+  assert(tier.getStore().read(0, &rec, 1) == 1 && rec.bucketStart == T0 && rec.count == 2);
+
+  // Later samples in the same minute start a second record for it
+  tier.add(T0 + 50, 2400, 0);
+  tier.add(T0 + 61, 2500, 0);
+  assert(tier.getStore().size() == 2);
+  assert(tier.getStore().read(1, &rec, 1) == 1 && rec.bucketStart == T0 && rec.count == 1);
+  assert(tier.openBucket(0, rec) && rec.bucketStart == T0 + 60);
+}
+
+int main() {
+  testOpenBucketAndFlush();
+  return 0;
+}
@@ -0,0 +1,108 @@
+// sources: TimeSeriesStore.cpp
+#include <cassert>
+#include <vector>
+#include "TimeSeriesStore.h"
+
+SystemLogger logger;
+SystemLogger::SystemLogger() {}
+void SystemLogger::addLog(String) {}
+
+static const uint32_t T0 = 1700000000;
+
+static void append(TimeSeriesStore& store, std::vector<uint32_t>& all, uint32_t ts) {
+  TempRecord rec = {ts, 2000, 0, 0};
+  store.append(&rec);
+  all.push_back(ts);
+}
+
+// What lowerBound() promises: wall-clock records before the result are
+// < ts, and those from it on are >= ts
+static void checkLowerBound(const TimeSeriesStore& store, const std::vector<uint32_t>& ring, uint32_t ts) {
+  uint32_t idx = store.lowerBound(ts);
+  assert(idx <= ring.size());
+  for (uint32_t i = 0; i < ring.size(); i++) {
+    if (ring[i] < 1000000000) continue;
+    if (i < idx) assert(ring[i] < ts);
+    else assert(ring[i] >= ts);
+  }
+}
+
+static void testBootRelativeRunInTheMiddle() {
+  LittleFS.files.clear();
+  TimeSeriesStore store("/t.dat", sizeof(TempRecord), 32);
+  assert(store.begin());
+
+  // Wrap the ring once, with a reboot (uptime seconds until NTP syncs)
+  // landing in the middle of it
+  std::vector<uint32_t> all;
+  for (int i = 0; i < 20; i++) append(store, all, T0 + i * 60);
+  for (int i = 0; i < 12; i++) append(store, all, 5 + i * 5);
+  for (int i = 20; i < 40; i++) append(store, all, T0 + i * 60);
+  store.flush();
+
+  std::vector<uint32_t> ring(all.end() - store.size(), all.end());
+  TempRecord recs[32];
+  assert(store.read(0, recs, 32) == ring.size());
+  for (size_t i = 0; i < ring.size(); i++) assert(recs[i].timestamp == ring[i]);
+
+  for (uint32_t ts = T0; ts <= T0 + 41 * 60; ts += 30) checkLowerBound(store, ring, ts);
+  checkLowerBound(store, ring, 0);
+  checkLowerBound(store, ring, UINT32_MAX);
+}
+
+static void testBootRelativeRunAtEitherEnd() {
+  LittleFS.files.clear();
+  TimeSeriesStore store("/t.dat", sizeof(TempRecord), 32);
+  assert(store.begin());
+
+  std::vector<uint32_t> all;
+  for (int i = 0; i < 6; i++) append(store, all, 5 + i * 5);
+  for (int i = 0; i < 10; i++) append(store, all, T0 + i * 60);
+  for (int i = 0; i < 6; i++) append(store, all, 5 + i * 5);
+  // Half on flash, half still staged
+  store.flush();
+  for (int i = 10; i < 14; i++) append(store, all, T0 + i * 60);
+  for (int i = 0; i < 3; i++) append(store, all, 5 + i * 5);
+
+  std::vector<uint32_t> ring(all.end() - store.size(), all.end());
+  for (uint32_t ts = T0 - 60; ts <= T0 + 15 * 60; ts += 30) checkLowerBound(store, ring, ts);
+}
+
+// An upload reads the oldest records and drops them once acknowledged; a
+// full ring may overwrite part of the batch before then
+static void testDropBeforeAfterOverwrite() {
+  LittleFS.files.clear();
+  TimeSeriesStore store("/t.dat", sizeof(TempRecord), 32);
+  assert(store.begin());
+
+  std::vector<uint32_t> all;
+  for (int i = 0; i < 32; i++) append(store, all, T0 + i * 60);
+  store.flush();
+
+  uint32_t seq = store.firstSeq();
+  TempRecord batch[10];
+  assert(store.read(0, batch, 10) == 10);
+
+  // Four of the ten sent are overwritten while the request is in flight
+  for (int i = 32; i < 36; i++) append(store, all, T0 + i * 60);
+  store.dropBefore(seq + 10);
+
+  // Everything newer than the batch is still there
+  TempRecord rec;
+  assert(store.size() == 26);
+  assert(store.read(0, &rec, 1) == 1 && rec.timestamp == T0 + 10 * 60);
+
+  // A batch that is gone entirely drops nothing
+  seq = store.firstSeq();
+  for (int i = 36; i < 70; i++) append(store, all, T0 + i * 60);
+  store.dropBefore(seq + 5);
+  assert(store.size() == 32);
+  assert(store.read(0, &rec, 1) == 1 && rec.timestamp == T0 + 38 * 60);
+}
+
+int main() {
+  testBootRelativeRunInTheMiddle();
+  testBootRelativeRunAtEitherEnd();
+  testDropBeforeAfterOverwrite();
+  return 0;
+}